@@ -0,0 +1,177 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// The plugin's saved state, in a compact binary form that is read without parsing anything.
+//
+// Layout, little endian:
+//   magic "AMST", version (uint16)
+//   the plugin's parameters: a count (uint16), then each normalised value (float32), by index
+//   a slot count (uint16), then for each slot in chain order its effect index (uint8) and its
+//   parameters, stored like the plugin's
+//   optionally, a preset count (uint16), then each preset's name (UTF-8, null terminated), size
+//   (int32) and state, which is a binary state itself
+//
+// Parameters are stored by their index, so new ones may only ever be appended to a parameter list.
+// Values for parameters that do not exist any more are skipped, and parameters missing from the
+// state go back to their defaults. Anything that cannot be read this way needs a new version.
+class BinaryState
+{
+public:
+    struct Slot
+    {
+        int effectIndex = 0;
+        Array<float> values;
+    };
+
+    struct Preset
+    {
+        String name;
+        MemoryBlock state;
+    };
+
+    static constexpr int magic = 0x54534d41;
+    static constexpr int version = 1;
+
+    static bool isBinaryState(const void* data, int sizeInBytes)
+    {
+        return sizeInBytes >= 4 && ByteOrder::littleEndianInt(data) == (uint32) magic;
+    }
+
+    static void writeHeader(MemoryOutputStream& stream)
+    {
+        stream.writeInt(magic);
+        stream.writeShort((short) version);
+    }
+
+    static void writeParameters(MemoryOutputStream& stream, const Array<AudioProcessorParameter*>& parameters)
+    {
+        stream.writeShort((short) parameters.size());
+
+        for (auto* parameter : parameters)
+            stream.writeFloat(parameter->getValue());
+    }
+
+    static void writeSlotCount(MemoryOutputStream& stream, int numSlots) { stream.writeShort((short) numSlots); }
+
+    static void writeSlot(MemoryOutputStream& stream, int effectIndex, const Array<AudioProcessorParameter*>& parameters)
+    {
+        stream.writeByte((char) effectIndex);
+        writeParameters(stream, parameters);
+    }
+
+    static void writePresetCount(MemoryOutputStream& stream, int numPresets) { stream.writeShort((short) numPresets); }
+
+    static void writePreset(MemoryOutputStream& stream, const String& name, const MemoryBlock& state)
+    {
+        stream.writeString(name);
+        stream.writeInt((int) state.getSize());
+        stream.write(state.getData(), state.getSize());
+    }
+
+    // Reads the whole state before anything is applied, so a truncated or newer state changes
+    // nothing.
+    bool read(const void* data, int sizeInBytes)
+    {
+        if (! isBinaryState(data, sizeInBytes))
+            return false;
+
+        MemoryInputStream stream(data, (size_t) sizeInBytes, false);
+        stream.readInt();
+
+        if ((int) (uint16) stream.readShort() > version)
+            return false;
+
+        if (! readParameters(stream, pluginValues) || stream.getNumBytesRemaining() < 2)
+            return false;
+
+        const auto numSlots = (int) (uint16) stream.readShort();
+
+        for (int i = 0; i < numSlots; ++i)
+        {
+            Slot slot;
+
+            if (stream.isExhausted())
+                return false;
+
+            slot.effectIndex = (int) (uint8) stream.readByte();
+
+            if (! readParameters(stream, slot.values))
+                return false;
+
+            slots.add(std::move(slot));
+        }
+
+        hasPresets = ! stream.isExhausted();
+
+        return ! hasPresets || readPresets(stream);
+    }
+
+    // Only changed values are set, so loading a state does not flood the host with notifications.
+    static void applyValues(const Array<AudioProcessorParameter*>& parameters, const Array<float>& values)
+    {
+        for (int i = 0; i < parameters.size(); ++i)
+        {
+            auto* parameter = parameters.getUnchecked(i);
+            const auto value = i < values.size() ? jlimit(0.0f, 1.0f, values.getUnchecked(i)) : parameter->getDefaultValue();
+
+            if (parameter->getValue() != value)
+                parameter->setValueNotifyingHost(value);
+        }
+    }
+
+    Array<float> pluginValues;
+    Array<Slot> slots;
+
+    // states saved before there were presets have none
+    bool hasPresets = false;
+    Array<Preset> presets;
+
+private:
+    static bool readParameters(MemoryInputStream& stream, Array<float>& values)
+    {
+        if (stream.getNumBytesRemaining() < 2)
+            return false;
+
+        const auto numValues = (int) (uint16) stream.readShort();
+
+        if (stream.getNumBytesRemaining() < (int64) numValues * (int64) sizeof(float))
+            return false;
+
+        values.resize(numValues);
+
+        for (auto& value : values)
+            value = stream.readFloat();
+
+        return true;
+    }
+
+    bool readPresets(MemoryInputStream& stream)
+    {
+        if (stream.getNumBytesRemaining() < 2)
+            return false;
+
+        const auto numPresets = (int) (uint16) stream.readShort();
+
+        for (int i = 0; i < numPresets; ++i)
+        {
+            Preset preset;
+            preset.name = stream.readString();
+
+            if (stream.getNumBytesRemaining() < 4)
+                return false;
+
+            const auto size = stream.readInt();
+
+            if (size < 0 || stream.getNumBytesRemaining() < size)
+                return false;
+
+            preset.state.setSize((size_t) size);
+            stream.read(preset.state.getData(), size);
+
+            presets.add(std::move(preset));
+        }
+
+        return true;
+    }
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Curves for AntiderivativeWaveShaper.
+//
+// A curve provides its function and its antiderivative. By default the shaper takes the difference
+// quotient of the antiderivative, falling back to the function at the midpoint where the two inputs
+// are too close for the quotient to be accurate. A curve with a better conditioned closed form
+// provides averageBetween() itself.
+template <typename Curve>
+struct AntiderivativeCurve
+{
+    static float averageBetween(float current, float previous) noexcept
+    {
+        const auto difference = current - previous;
+
+        if (std::abs(difference) < 1.0e-3f)
+            return Curve::function(0.5f * (current + previous));
+
+        return (Curve::antiderivative(current) - Curve::antiderivative(previous)) / difference;
+    }
+};
+
+struct SineCurve : AntiderivativeCurve<SineCurve>
+{
+    static float function(float x) noexcept { return sine(x); }
+
+    static float antiderivative(float x) noexcept { return -sine(x + MathConstants<float>::halfPi); }
+
+    // (cos(b) - cos(a)) / (a - b) is sin((a + b) / 2) * sinc((a - b) / 2), which holds up for any
+    // distance between the inputs
+    static float averageBetween(float current, float previous) noexcept
+    {
+        const auto halfDifference = 0.5f * (current - previous);
+        const auto sinc = std::abs(halfDifference) < 1.0e-4f ? 1.0f : sine(halfDifference) / halfDifference;
+
+        return sine(0.5f * (current + previous)) * sinc;
+    }
+
+    // Wraps into [-pi, pi] and folds into [-pi / 2, pi / 2] without branches, then evaluates the
+    // Taylor polynomial up to x^11, which is accurate to about 1e-7 there.
+    static float sine(float x) noexcept
+    {
+        constexpr auto roundingMagic = 12582912.0f;
+
+        const auto turns = (x * (1.0f / MathConstants<float>::twoPi) + roundingMagic) - roundingMagic;
+        const auto wrapped = x - turns * MathConstants<float>::twoPi;
+
+        const auto clamped = jlimit(-MathConstants<float>::halfPi, MathConstants<float>::halfPi, wrapped);
+        const auto folded = clamped + (clamped - wrapped);
+        const auto squared = folded * folded;
+
+        return folded
+               * (1.0f
+                  + squared * (-1.0f / 6.0f
+                  + squared * (1.0f / 120.0f
+                  + squared * (-1.0f / 5040.0f
+                  + squared * (1.0f / 362880.0f
+                  + squared * (-1.0f / 39916800.0f))))));
+    }
+};
+
+// A waveshaper with first-order antiderivative anti-aliasing.
+//
+// Each output sample is the curve averaged between the previous and the current input, which
+// suppresses the aliasing of the curve's harmonics much like heavy oversampling would, at the cost
+// of half a sample of delay. The curve is called directly from a plain loop over each channel, so
+// the compiler can inline and vectorize it.
+template <typename Curve>
+class AntiderivativeWaveShaper
+{
+public:
+    void prepare(const dsp::ProcessSpec& spec)
+    {
+        lastInput.resize(spec.numChannels);
+        reset();
+    }
+
+    void reset() { std::fill(lastInput.begin(), lastInput.end(), 0.0f); }
+
+    void process(const dsp::ProcessContextReplacing<float>& context)
+    {
+        const auto& block = context.getOutputBlock();
+        const auto numSamples = (int) block.getNumSamples();
+
+        if (numSamples == 0)
+            return;
+
+        jassert(block.getNumChannels() <= lastInput.size());
+
+        for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+        {
+            auto* samples = block.getChannelPointer(channel);
+            const auto previous = lastInput[channel];
+
+            lastInput[channel] = samples[numSamples - 1];
+
+            // backwards, so every sample still sees the input before it
+            for (int i = numSamples - 1; i > 0; --i)
+                samples[i] = Curve::averageBetween(samples[i], samples[i - 1]);
+
+            samples[0] = Curve::averageBetween(samples[0], previous);
+        }
+    }
+
+private:
+    std::vector<float> lastInput;
+};
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "BlockSmoother.h"
+
+// The auto-wah's envelope follower and ladder filter in one block-based engine.
+//
+// The envelope of channel 0 is followed for the whole block up front. The cutoff is then only
+// recomputed every controlInterval samples and the filter coefficient is interpolated linearly in
+// between, so no per-sample setup is left in the filter loop. The range glides to new settings over
+// 50 ms like the other parameters, read once per control interval. The ladder itself is the one from
+// dsp::LadderFilter, run with the channels side by side in SIMD lanes.
+class AutoWahFilter
+{
+public:
+    AutoWahFilter()
+    {
+        setMode(dsp::LadderFilterMode::BPF12);
+        setResonance(0.7f);
+    }
+
+    void prepare(const dsp::ProcessSpec& spec)
+    {
+        sampleRate = (float) spec.sampleRate;
+        maximumBlockSize = (int) spec.maximumBlockSize;
+        numChannels = (int) spec.numChannels;
+
+        cutoffScaler = -MathConstants<float>::twoPi / sampleRate;
+
+        // dsp::LadderFilter glides its coefficient towards each new cutoff over 50 ms
+        cutoffSmoothing = 1.0f - 1.0f / jmax(1.0f, 0.05f * sampleRate);
+
+        fromHz.reset(sampleRate, 0.05);
+        toHz.reset(sampleRate, 0.05);
+
+        envelope.allocate((size_t) maximumBlockSize, true);
+        state.resize((size_t) ((numChannels + (int) laneCount - 1) / (int) laneCount));
+
+        reset();
+    }
+
+    void reset()
+    {
+        for (auto& lanes : state)
+            lanes.fill(Lanes::expand(0.0f));
+
+        lastEnvelope = 0.0f;
+        fromHz.setCurrentAndTargetValue(fromHz.getTargetValue());
+        toHz.setCurrentAndTargetValue(toHz.getTargetValue());
+
+        cutoffTransform = std::exp(cutoffScaler * fromHz.getCurrentValue());
+    }
+
+    void setMode(dsp::LadderFilterMode newMode)
+    {
+        if (newMode == mode)
+            return;
+
+        switch (newMode)
+        {
+            case dsp::LadderFilterMode::LPF12:
+                mixing = { 0.0f, 0.0f, 1.0f, 0.0f, 0.0f };
+                compensation = 0.5f;
+                break;
+            case dsp::LadderFilterMode::HPF12:
+                mixing = { 1.0f, -2.0f, 1.0f, 0.0f, 0.0f };
+                compensation = 0.0f;
+                break;
+            case dsp::LadderFilterMode::BPF12:
+                mixing = { 0.0f, 0.0f, -1.0f, 1.0f, 0.0f };
+                compensation = 0.5f;
+                break;
+            case dsp::LadderFilterMode::LPF24:
+                mixing = { 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+                compensation = 0.5f;
+                break;
+            case dsp::LadderFilterMode::HPF24:
+                mixing = { 1.0f, -4.0f, 6.0f, -4.0f, 1.0f };
+                compensation = 0.0f;
+                break;
+            case dsp::LadderFilterMode::BPF24:
+                mixing = { 0.0f, 0.0f, 4.0f, -8.0f, 4.0f };
+                compensation = 0.5f;
+                break;
+            default:
+                jassertfalse;
+                break;
+        }
+
+        for (auto& a : mixing)
+            a *= outputGain;
+
+        // only the outputs are mixed differently, so the ladder carries on from where it is
+        mode = newMode;
+    }
+
+    void setResonance(float newResonance) { scaledResonance = jmap(newResonance, 0.1f, 1.0f); }
+
+    // The time the envelope takes to fall to a tenth after the input stops.
+    void setEnvelopeTime(float seconds) { envelopeTime = seconds; }
+
+    void setRange(float newFromHz, float newToHz)
+    {
+        fromHz.setTargetValue(newFromHz);
+        toHz.setTargetValue(newToHz);
+    }
+
+    void setControlInterval(int numSamples) { controlInterval = jmax(1, numSamples); }
+
+    // The cutoff the envelope last asked for, in Hz.
+    float getCutoff() const noexcept { return cutoffHz; }
+
+    bool isSmoothing() const noexcept { return fromHz.isSmoothing() || toHz.isSmoothing(); }
+
+    void process(const dsp::ProcessContextReplacing<float>& context)
+    {
+        const auto& inputBlock = context.getInputBlock();
+        const auto& outputBlock = context.getOutputBlock();
+        const auto numSamples = (int) inputBlock.getNumSamples();
+
+        jassert((int) inputBlock.getNumChannels() <= numChannels);
+
+        if (maximumBlockSize <= 0)
+        {
+            jassertfalse;
+            return;
+        }
+
+        for (int start = 0; start < numSamples; start += maximumBlockSize)
+        {
+            auto length = jmin(maximumBlockSize, numSamples - start);
+            processSubBlock(inputBlock.getSubBlock((size_t) start, (size_t) length),
+                            outputBlock.getSubBlock((size_t) start, (size_t) length));
+        }
+    }
+
+private:
+    using Lanes = dsp::SIMDRegister<float>;
+    static constexpr size_t laneCount = Lanes::size();
+
+    static constexpr float drive = 1.2f;
+    static constexpr float drive2 = drive * 0.04f + 0.96f;
+    static constexpr float outputGain = 1.2f;
+
+    void processSubBlock(const dsp::AudioBlock<const float>& input, const dsp::AudioBlock<float>& output)
+    {
+        const auto numSamples = (int) input.getNumSamples();
+        const auto numBlockChannels = (int) input.getNumChannels();
+
+        // assume the attack of audio channel 0 decide auto-wah effect
+        const auto alpha = std::exp(-std::log(9.0f) / (sampleRate * envelopeTime));
+        auto* env = envelope.getData();
+
+        FloatVectorOperations::abs(env, input.getChannelPointer(0), numSamples);
+        FloatVectorOperations::multiply(env, 1.0f - alpha, numSamples);
+
+        for (int i = 0; i < numSamples; ++i)
+            env[i] = lastEnvelope = env[i] + alpha * lastEnvelope;
+
+        for (int start = 0; start < numSamples; start += controlInterval)
+        {
+            const auto length = jmin(controlInterval, numSamples - start);
+            const auto from = fromHz.advance(length);
+            const auto to = toHz.advance(length);
+
+            cutoffHz = jmin(from + env[start] * to, to);
+            const auto target = std::exp(cutoffScaler * cutoffHz);
+
+            // closed form of the per-sample glide over the whole interval
+            const auto startTransform = cutoffTransform;
+            cutoffTransform = target + (startTransform - target) * std::pow(cutoffSmoothing, (float) length);
+
+            const auto step = (cutoffTransform - startTransform) / (float) length;
+
+            for (int firstChannel = 0; firstChannel < numBlockChannels; firstChannel += (int) laneCount)
+                processLanes(input, output, firstChannel, start, length, startTransform, step);
+        }
+    }
+
+    void processLanes(const dsp::AudioBlock<const float>& input,
+                      const dsp::AudioBlock<float>& output,
+                      int firstChannel,
+                      int start,
+                      int length,
+                      float startTransform,
+                      float step)
+    {
+        const auto numLanes = jmin((int) laneCount, (int) input.getNumChannels() - firstChannel);
+        auto& s = state[(size_t) firstChannel / laneCount];
+
+        const float* in[laneCount] = {};
+        float* out[laneCount] = {};
+
+        for (int lane = 0; lane < numLanes; ++lane)
+        {
+            in[lane] = input.getChannelPointer((size_t) (firstChannel + lane)) + start;
+            out[lane] = output.getChannelPointer((size_t) (firstChannel + lane)) + start;
+        }
+
+        const auto resonance = Lanes::expand(scaledResonance * -4.0f);
+        const auto comp = Lanes::expand(compensation);
+        const auto gain2Lanes = Lanes::expand(gain2);
+
+        alignas(Lanes::SIMDRegisterSize) float driven[laneCount] = {};
+        alignas(Lanes::SIMDRegisterSize) float feedback[laneCount] = {};
+        alignas(Lanes::SIMDRegisterSize) float result[laneCount] = {};
+
+        for (int i = 0; i < length; ++i)
+        {
+            const auto a1Value = startTransform + step * (float) (i + 1);
+            const auto a1 = Lanes::expand(a1Value);
+            const auto g = Lanes::expand(1.0f - a1Value);
+            const auto b0 = g * Lanes::expand(0.76923076923f);
+            const auto b1 = g * Lanes::expand(0.23076923076f);
+
+            (s[4] * Lanes::expand(drive2)).copyToRawArray(feedback);
+
+            for (int lane = 0; lane < numLanes; ++lane)
+            {
+                driven[lane] = gain * saturation.processSample(drive * in[lane][i]);
+                feedback[lane] = saturation.processSample(feedback[lane]);
+            }
+
+            const auto dx = Lanes::fromRawArray(driven);
+            const auto a = dx + resonance * (gain2Lanes * Lanes::fromRawArray(feedback) - dx * comp);
+            const auto b = b1 * s[0] + a1 * s[1] + b0 * a;
+            const auto c = b1 * s[1] + a1 * s[2] + b0 * b;
+            const auto d = b1 * s[2] + a1 * s[3] + b0 * c;
+            const auto e = b1 * s[3] + a1 * s[4] + b0 * d;
+
+            s = { a, b, c, d, e };
+
+            (a * Lanes::expand(mixing[0]) + b * Lanes::expand(mixing[1]) + c * Lanes::expand(mixing[2])
+             + d * Lanes::expand(mixing[3]) + e * Lanes::expand(mixing[4]))
+                .copyToRawArray(result);
+
+            for (int lane = 0; lane < numLanes; ++lane)
+                out[lane][i] = result[lane];
+        }
+    }
+
+    static float driveGain(float driveAmount) { return std::pow(driveAmount, -2.642f) * 0.6103f + 0.3903f; }
+
+    const float gain = driveGain(drive);
+    const float gain2 = driveGain(drive2);
+
+    dsp::LookupTableTransform<float> saturation { [](float x) { return std::tanh(x); }, -5.0f, 5.0f, 128 };
+
+    dsp::LadderFilterMode mode = dsp::LadderFilterMode::LPF24;
+    std::array<float, 5> mixing {};
+    float compensation = 0.5f;
+    float scaledResonance = 0.1f;
+
+    float sampleRate = 44100.0f;
+    int maximumBlockSize = 0;
+    int numChannels = 0;
+    int controlInterval = 32;
+
+    float envelopeTime = 0.15f;
+    BlockSmoother fromHz { 500.0f };
+    BlockSmoother toHz { 3000.0f };
+    float cutoffHz = 500.0f;
+
+    float cutoffScaler = 0.0f;
+    float cutoffSmoothing = 0.0f;
+    float cutoffTransform = 1.0f;
+    float lastEnvelope = 0.0f;
+
+    HeapBlock<float> envelope;
+    std::vector<std::array<Lanes, 5>> state;
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "../ScratchArena.h"
+
+// A linearly smoothed parameter, read a whole block at a time.
+//
+// getRamp() writes the block's values in one plain loop the compiler vectorizes, instead of a
+// getNextValue() call per sample. Once the target is reached it costs nothing: the ramp is a single
+// value, and callers take their constant fast paths. Until reset() gives it a ramp time, a new
+// target is taken at once, so values set before prepare() do not glide in.
+class BlockSmoother
+{
+public:
+    // The smoothed value over one block: either one value, or one per sample while it moves.
+    struct Ramp
+    {
+        float value = 0.0f;
+        float* values = nullptr;
+
+        bool isConstant() const noexcept { return values == nullptr; }
+
+        float operator[](int i) const noexcept { return values != nullptr ? values[i] : value; }
+
+        // Scales the span by the ramp, from the ramp's sample offset on.
+        void multiply(float* samples, int offset, int numSamples) const noexcept
+        {
+            if (values != nullptr)
+                FloatVectorOperations::multiply(samples, values + offset, numSamples);
+            else
+                FloatVectorOperations::multiply(samples, value, numSamples);
+        }
+    };
+
+    BlockSmoother() = default;
+
+    explicit BlockSmoother(float initialValue) noexcept : current(initialValue), target(initialValue) {}
+
+    // Jumps to the target.
+    void reset(double sampleRate, double rampSeconds) noexcept
+    {
+        rampLength = jmax(1, roundToInt(sampleRate * rampSeconds));
+        setCurrentAndTargetValue(target);
+    }
+
+    void setTargetValue(float newTarget) noexcept
+    {
+        if (newTarget == target)
+            return;
+
+        if (rampLength <= 1)
+        {
+            setCurrentAndTargetValue(newTarget);
+            return;
+        }
+
+        target = newTarget;
+        countdown = rampLength;
+        step = (target - current) / (float) countdown;
+    }
+
+    void setCurrentAndTargetValue(float newValue) noexcept
+    {
+        current = target = newValue;
+        countdown = 0;
+    }
+
+    float getCurrentValue() const noexcept { return current; }
+    float getTargetValue() const noexcept { return target; }
+    bool isSmoothing() const noexcept { return countdown > 0; }
+
+    // The next numSamples values, borrowed from the arena while the value moves. Without room in the
+    // arena, the value steps to where the block ends instead.
+    Ramp getRamp(ScratchArena& arena, int numSamples)
+    {
+        Ramp ramp;
+
+        if (countdown == 0)
+        {
+            ramp.value = target;
+            return ramp;
+        }
+
+        ramp.values = arena.allocate((size_t) numSamples);
+
+        if (ramp.values == nullptr)
+            ramp.value = advance(numSamples);
+        else
+            fill(ramp.values, numSamples);
+
+        return ramp;
+    }
+
+    // Writes the next numSamples values.
+    void fill(float* dest, int numSamples) noexcept
+    {
+        const auto numRamped = jmin(numSamples, countdown);
+        const auto start = current;
+
+        for (int i = 0; i < numRamped; ++i)
+            dest[i] = start + step * (float) (i + 1);
+
+        FloatVectorOperations::fill(dest + numRamped, target, numSamples - numRamped);
+        advance(numSamples);
+    }
+
+    // Moves on by numSamples without reading them, for a value that is only read once in a while.
+    // Returns the value it got to.
+    float advance(int numSamples) noexcept
+    {
+        const auto numRamped = jmin(numSamples, countdown);
+
+        countdown -= numRamped;
+        current = countdown > 0 ? current + step * (float) numRamped : target;
+
+        return current;
+    }
+
+private:
+    float current = 0.0f;
+    float target = 0.0f;
+    float step = 0.0f;
+    int countdown = 0;
+    int rampLength = 0;
+};
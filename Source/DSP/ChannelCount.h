@@ -0,0 +1,28 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Calls func with the channel count as a compile-time constant for mono and stereo, so the channel
+// loops of those paths unroll, or with 0 for any other count:
+//
+//     withChannelCount(numChannels, [&](auto channels) { process<decltype(channels)::value>(block); });
+template <typename Func>
+decltype(auto) withChannelCount(size_t numChannels, Func&& func)
+{
+    switch (numChannels)
+    {
+        case 1:
+            return func(std::integral_constant<int, 1>());
+        case 2:
+            return func(std::integral_constant<int, 2>());
+        default:
+            return func(std::integral_constant<int, 0>());
+    }
+}
+
+// The number of channels a path specialized by withChannelCount() loops over.
+template <int NumChannels>
+constexpr size_t getChannelCount(size_t numChannels) noexcept
+{
+    return NumChannels > 0 ? (size_t) NumChannels : numChannels;
+}
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "../ScratchArena.h"
+#include "BlockSmoother.h"
+#include "ChannelCount.h"
+
+// Delay line samples kept as plain floats.
+struct FloatDelayStorage
+{
+    using Type = float;
+
+    static float toFloat(Type sample) noexcept { return sample; }
+    static Type fromFloat(float sample) noexcept { return sample; }
+
+    static void write(Type* dest, const float* source, int numSamples) noexcept
+    {
+        FloatVectorOperations::copy(dest, source, numSamples);
+    }
+
+    // Returns the samples as floats, converting into the scratch buffer only if needed.
+    static const float* read(const Type* source, float*, int) noexcept { return source; }
+};
+
+// Delay line samples kept as IEEE half floats, which halves the memory long delays stream through.
+// The conversions round to nearest even and keep denormals, infinities and NaNs.
+struct HalfFloatDelayStorage
+{
+    using Type = uint16;
+
+    static float toFloat(Type sample) noexcept
+    {
+        constexpr uint32 shiftedExponent = 0x7c00u << 13;
+        const auto magic = fromBits(113u << 23);
+
+        auto bits = (uint32) (sample & 0x7fff) << 13;
+        const auto exponent = bits & shiftedExponent;
+        bits += (127u - 15u) << 23;
+
+        if (exponent == shiftedExponent)
+            bits += (128u - 16u) << 23;
+        else if (exponent == 0)
+            bits = toBits(fromBits(bits + (1u << 23)) - magic);
+
+        return fromBits(bits | (uint32) (sample & 0x8000) << 16);
+    }
+
+    static Type fromFloat(float sample) noexcept
+    {
+        constexpr uint32 infinity = 255u << 23;
+        constexpr uint32 halfMaximum = (127u + 16u) << 23;
+        constexpr uint32 denormalMagic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+        auto bits = toBits(sample);
+        const auto sign = bits & 0x80000000u;
+        bits ^= sign;
+
+        uint32 result;
+
+        if (bits >= halfMaximum)
+        {
+            result = bits > infinity ? 0x7e00u : 0x7c00u;
+        }
+        else if (bits < (113u << 23))
+        {
+            result = toBits(fromBits(bits) + fromBits(denormalMagic)) - denormalMagic;
+        }
+        else
+        {
+            const auto mantissaOdd = (bits >> 13) & 1u;
+            bits += ((uint32) (15 - 127) << 23) + 0xfffu + mantissaOdd;
+            result = bits >> 13;
+        }
+
+        return (Type) (result | sign >> 16);
+    }
+
+    static void write(Type* dest, const float* source, int numSamples) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] = fromFloat(source[i]);
+    }
+
+    static const float* read(const Type* source, float* scratch, int numSamples) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            scratch[i] = toFloat(source[i]);
+
+        return scratch;
+    }
+
+private:
+    static uint32 toBits(float value) noexcept
+    {
+        uint32 bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    static float fromBits(uint32 bits) noexcept
+    {
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+};
+
+// The echo's feedback delay line, processed a span at a time, with its dry/wet mix.
+//
+// It matches dsp::DelayLine with third-order Lagrange interpolation, fed back negatively:
+// x[n] = in[n] - g * y[n - 1], where y is x read back with the current delay. While the delay holds
+// still, the output of a whole span only depends on samples that are already in the ring. So the
+// four interpolation taps are read as contiguous spans and combined with vector operations, for all
+// channels. A delay change is ramped over the block sample by sample instead.
+//
+// With the linear dry/wet rule, in * (1 - wet) + x * wet is in - wet * g * y[n - 1], so the mix is
+// applied to the block in place and no copy of the dry input is kept.
+//
+// Storage decides how the ring keeps its samples, see FloatDelayStorage and HalfFloatDelayStorage.
+template <typename Storage>
+class EchoDelayLine
+{
+public:
+    // The scratch memory process() borrows, in samples.
+    static size_t getScratchSize(int maximumBlockSize) noexcept
+    {
+        return ScratchArena::getPaddedSize((size_t) maximumBlockSize + 3)
+               + 4 * ScratchArena::getPaddedSize((size_t) maximumBlockSize);
+    }
+
+    void prepare(const dsp::ProcessSpec& spec, int maximumDelayInSamples)
+    {
+        maximumBlockSize = (int) spec.maximumBlockSize;
+        maximumDelay = (float) maximumDelayInSamples;
+
+        // the guard repeats the start of the ring after its end, so that the window a span of up to
+        // maximumBlockSize samples reads from never wraps
+        size = maximumDelayInSamples + 4;
+        guard = maximumBlockSize + 3;
+        numChannels = (int) spec.numChannels;
+
+        ring.allocate((size_t) (numChannels * (size + guard)), true);
+        lastOutput.resize(spec.numChannels);
+
+        feedback.reset(spec.sampleRate, 0.05);
+        wetMix.reset(spec.sampleRate, 0.05);
+
+        reset();
+    }
+
+    void reset()
+    {
+        ring.clear((size_t) (numChannels * (size + guard)));
+        std::fill(lastOutput.begin(), lastOutput.end(), 0.0f);
+
+        writePosition = 0;
+        currentDelay = targetDelay;
+    }
+
+    // Takes effect over the next processed block.
+    void setDelay(float delayInSamples) { targetDelay = jlimit(0.0f, maximumDelay, delayInSamples); }
+
+    void setFeedback(float gain) { feedback.setTargetValue(gain); }
+
+    void setWetMixProportion(float proportion) { wetMix.setTargetValue(proportion); }
+
+    // Whether the delay, the feedback or the mix is still gliding.
+    bool isSmoothing() const noexcept { return currentDelay != targetDelay || feedback.isSmoothing() || wetMix.isSmoothing(); }
+
+    void process(const dsp::ProcessContextReplacing<float>& context, ScratchArena& arena)
+    {
+        auto& outputBlock = context.getOutputBlock();
+        const auto numSamples = (int) outputBlock.getNumSamples();
+
+        jassert(outputBlock.getNumChannels() <= lastOutput.size());
+
+        if (maximumBlockSize <= 0)
+        {
+            jassertfalse;
+            return;
+        }
+
+        for (int start = 0; start < numSamples; start += maximumBlockSize)
+        {
+            auto length = jmin(maximumBlockSize, numSamples - start);
+            processSubBlock(outputBlock.getSubBlock((size_t) start, (size_t) length), arena);
+        }
+    }
+
+private:
+    struct Taps
+    {
+        int offset;
+        float coefficients[4];
+    };
+
+    // the same tap layout as dsp::DelayLineInterpolationTypes::Lagrange3rd
+    static Taps getTaps(float delay) noexcept
+    {
+        auto delayInt = (int) delay;
+        auto delayFrac = delay - (float) delayInt;
+
+        if (delayInt >= 1)
+        {
+            delayFrac++;
+            delayInt--;
+        }
+
+        auto d1 = delayFrac - 1.0f;
+        auto d2 = delayFrac - 2.0f;
+        auto d3 = delayFrac - 3.0f;
+
+        return { delayInt,
+                 { -d1 * d2 * d3 / 6.0f,
+                   delayFrac * d2 * d3 * 0.5f,
+                   -delayFrac * d1 * d3 * 0.5f,
+                   delayFrac * d1 * d2 / 6.0f } };
+    }
+
+    void processSubBlock(const dsp::AudioBlock<float>& block, ScratchArena& arena)
+    {
+        const auto numSamples = (int) block.getNumSamples();
+
+        ScratchArena::Scope scope(arena);
+
+        const auto feedbackRamp = feedback.getRamp(arena, numSamples);
+        const auto wetRamp = wetMix.getRamp(arena, numSamples);
+
+        // a change too small to hear is taken at once, so the delay counts as settled
+        if (std::abs(targetDelay - currentDelay) < 1.0e-3f)
+            currentDelay = targetDelay;
+
+        // the latest sample a span of length n reads back is n - floor(delay) + 1 samples ahead of it
+        const auto maximumSpan = (int) currentDelay - 1;
+
+        if (currentDelay == targetDelay && maximumSpan >= 1 && processFixedDelay(block, arena, feedbackRamp, wetRamp, maximumSpan))
+            return;
+
+        withChannelCount(block.getNumChannels(), [&](auto channels) {
+            processRampedDelay<decltype(channels)::value>(block, feedbackRamp, wetRamp);
+        });
+    }
+
+    // Returns false, without processing, if the arena has no room for its buffers.
+    bool processFixedDelay(const dsp::AudioBlock<float>& block,
+                           ScratchArena& arena,
+                           const BlockSmoother::Ramp& feedbackRamp,
+                           const BlockSmoother::Ramp& wetRamp,
+                           int maximumSpan)
+    {
+        const auto numSamples = (int) block.getNumSamples();
+        const auto numBlockChannels = (int) block.getNumChannels();
+        const auto taps = getTaps(currentDelay);
+
+        auto* window = arena.allocate((size_t) numSamples + 3);
+        auto* delayed = arena.allocate((size_t) numSamples);
+        auto* fedBack = arena.allocate((size_t) numSamples);
+
+        if (window == nullptr || delayed == nullptr || fedBack == nullptr)
+            return false;
+
+        for (int start = 0; start < numSamples; start += maximumSpan)
+        {
+            const auto length = jmin(maximumSpan, numSamples - start);
+
+            for (int channel = 0; channel < numBlockChannels; ++channel)
+            {
+                auto* samples = block.getChannelPointer((size_t) channel) + start;
+                auto& last = lastOutput[(size_t) channel];
+
+                // tap k of sample i is at taken[i + 3 - k]
+                auto* taken = Storage::read(getChannel(channel) + wrap(writePosition - taps.offset - 3), window, length + 3);
+
+                FloatVectorOperations::copyWithMultiply(delayed, taken + 3, taps.coefficients[0], length);
+
+                for (int k = 1; k < 4; ++k)
+                    FloatVectorOperations::addWithMultiply(delayed, taken + 3 - k, taps.coefficients[k], length);
+
+                // g * y[n - 1] for the span
+                fedBack[0] = last;
+                FloatVectorOperations::copy(fedBack + 1, delayed, length - 1);
+                feedbackRamp.multiply(fedBack, start, length);
+
+                last = delayed[length - 1];
+
+                FloatVectorOperations::subtract(window, samples, fedBack, length);
+                write(channel, window, length);
+
+                wetRamp.multiply(fedBack, start, length);
+                FloatVectorOperations::subtract(samples, fedBack, length);
+            }
+
+            writePosition = wrap(writePosition + length);
+        }
+
+        return true;
+    }
+
+    // Sample by sample, so the inner loop over the channels is unrolled for mono and stereo.
+    template <int NumChannels>
+    void processRampedDelay(const dsp::AudioBlock<float>& block, const BlockSmoother::Ramp& feedbackRamp, const BlockSmoother::Ramp& wetRamp)
+    {
+        const auto numSamples = (int) block.getNumSamples();
+        const auto numBlockChannels = (int) getChannelCount<NumChannels>(block.getNumChannels());
+        const auto step = (targetDelay - currentDelay) / (float) numSamples;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const auto taps = getTaps(currentDelay + step * (float) (i + 1));
+            const auto gain = feedbackRamp[i];
+            const auto wet = wetRamp[i];
+
+            for (int channel = 0; channel < numBlockChannels; ++channel)
+            {
+                auto& sample = block.getChannelPointer((size_t) channel)[i];
+                auto& last = lastOutput[(size_t) channel];
+
+                const auto fedBack = gain * last;
+                const auto written = sample - fedBack;
+
+                write(channel, &written, 1);
+                sample -= wet * fedBack;
+
+                auto* ringData = getChannel(channel);
+                auto readPosition = writePosition - taps.offset;
+
+                last = taps.coefficients[0] * Storage::toFloat(ringData[wrap(readPosition)])
+                       + taps.coefficients[1] * Storage::toFloat(ringData[wrap(readPosition - 1)])
+                       + taps.coefficients[2] * Storage::toFloat(ringData[wrap(readPosition - 2)])
+                       + taps.coefficients[3] * Storage::toFloat(ringData[wrap(readPosition - 3)]);
+            }
+
+            writePosition = wrap(writePosition + 1);
+        }
+
+        currentDelay = targetDelay;
+    }
+
+    // Writes the span starting at the write position, keeping the guard in step with the ring start.
+    void write(int channel, const float* source, int numSamples)
+    {
+        auto* ringData = getChannel(channel);
+        auto position = writePosition;
+
+        while (numSamples > 0)
+        {
+            auto length = jmin(numSamples, size - position);
+
+            Storage::write(ringData + position, source, length);
+
+            if (position < guard)
+                Storage::write(ringData + size + position, source, jmin(length, guard - position));
+
+            source += length;
+            numSamples -= length;
+            position = 0;
+        }
+    }
+
+    typename Storage::Type* getChannel(int channel) const noexcept { return ring + channel * (size + guard); }
+
+    int wrap(int position) const noexcept
+    {
+        position %= size;
+        return position < 0 ? position + size : position;
+    }
+
+    HeapBlock<typename Storage::Type> ring;
+    int numChannels = 0;
+    int size = 4;
+    int guard = 0;
+    int writePosition = 0;
+    int maximumBlockSize = 0;
+
+    float maximumDelay = 0.0f;
+    float currentDelay = 0.0f;
+    float targetDelay = 0.0f;
+
+    BlockSmoother feedback;
+    BlockSmoother wetMix;
+
+    std::vector<float> lastOutput;
+};
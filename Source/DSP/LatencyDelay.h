@@ -0,0 +1,119 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Delays a block in place by a small whole number of samples, e.g. to line a dry signal up with a
+// wet path that has latency. The last maximumLatency samples of each channel are always kept, so
+// the latency can change without a gap, and read() can tap the history at another latency.
+class LatencyDelay
+{
+public:
+    // Reserves room for latencies up to maximumLatency, and starts out at that.
+    void prepare(const dsp::ProcessSpec& spec, int maximumLatency)
+    {
+        maximumLatency = jmax(0, maximumLatency);
+
+        history.setSize((int) spec.numChannels, maximumLatency);
+        spare.setSize(1, jmax(maximumLatency, 1));
+
+        reset();
+        setLatency(maximumLatency);
+    }
+
+    // Keeps the history, so the delayed signal carries on from the new latency.
+    void setLatency(int latencyInSamples) noexcept
+    {
+        jassert(latencyInSamples <= history.getNumSamples());
+
+        latency = jlimit(0, history.getNumSamples(), latencyInSamples);
+    }
+
+    void reset() { history.clear(); }
+
+    int getLatencyInSamples() const noexcept { return latency; }
+
+    void process(const dsp::ProcessContextReplacing<float>& context)
+    {
+        const auto& block = context.getOutputBlock();
+        const auto numSamples = (int) block.getNumSamples();
+        const auto size = history.getNumSamples();
+
+        if (size == 0)
+            return;
+
+        for (int channel = 0; channel < (int) block.getNumChannels(); ++channel)
+        {
+            auto* samples = block.getChannelPointer((size_t) channel);
+            auto* past = history.getWritePointer(channel);
+            auto* held = spare.getWritePointer(0);
+
+            // the history as it will be after this block
+            if (numSamples >= size)
+            {
+                FloatVectorOperations::copy(held, samples + numSamples - size, size);
+            }
+            else
+            {
+                FloatVectorOperations::copy(held, past + numSamples, size - numSamples);
+                FloatVectorOperations::copy(held + size - numSamples, samples, numSamples);
+            }
+
+            if (numSamples > latency)
+                std::memmove(samples + latency, samples, (size_t) (numSamples - latency) * sizeof(float));
+
+            FloatVectorOperations::copy(samples, past + size - latency, jmin(numSamples, latency));
+            FloatVectorOperations::copy(past, held, size);
+        }
+    }
+
+    // Writes the input delayed by tapLatency to the output, which must be another block, without
+    // taking the input in; process() or push() does that afterwards.
+    void read(const dsp::AudioBlock<const float>& input, const dsp::AudioBlock<float>& output, int tapLatency) const
+    {
+        const auto numSamples = (int) input.getNumSamples();
+        tapLatency = jlimit(0, history.getNumSamples(), tapLatency);
+
+        for (int channel = 0; channel < (int) input.getNumChannels(); ++channel)
+        {
+            auto* samples = input.getChannelPointer((size_t) channel);
+            auto* dest = output.getChannelPointer((size_t) channel);
+            auto* past = history.getReadPointer(channel);
+
+            FloatVectorOperations::copy(dest, past + history.getNumSamples() - tapLatency, jmin(numSamples, tapLatency));
+
+            if (numSamples > tapLatency)
+                FloatVectorOperations::copy(dest + tapLatency, samples, numSamples - tapLatency);
+        }
+    }
+
+    // Takes in a block without delaying it, so the delay picks up seamlessly when it is next used.
+    void push(const dsp::AudioBlock<const float>& block)
+    {
+        const auto numSamples = (int) block.getNumSamples();
+        const auto size = history.getNumSamples();
+
+        if (size == 0)
+            return;
+
+        for (int channel = 0; channel < (int) block.getNumChannels(); ++channel)
+        {
+            auto* samples = block.getChannelPointer((size_t) channel);
+            auto* past = history.getWritePointer(channel);
+
+            if (numSamples >= size)
+            {
+                FloatVectorOperations::copy(past, samples + numSamples - size, size);
+            }
+            else
+            {
+                std::memmove(past, past + numSamples, (size_t) (size - numSamples) * sizeof(float));
+                FloatVectorOperations::copy(past + size - numSamples, samples, numSamples);
+            }
+        }
+    }
+
+private:
+    int latency = 0;
+    AudioBuffer<float> history;
+    AudioBuffer<float> spare;
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "../ScratchArena.h"
+#include "BlockSmoother.h"
+#include "ChannelCount.h"
+
+// The compressor's core: the peak ballistics and hard knee of dsp::Compressor, with one detector
+// for all channels, so gain reduction does not pull the stereo image around.
+//
+// The detector takes the loudest channel in plain loops over the block, and only the ballistics
+// run sample by sample. The gain computer works in log2 units with polynomial log2 and exp2, so it
+// vectorizes too, and the one gain per sample is applied to every channel with vector operations.
+// Threshold and ratio changes glide over 50 ms; attack and release only change the ballistics, so
+// they take effect at once.
+class LinkedCompressor
+{
+public:
+    // The scratch memory process() borrows, in samples.
+    static size_t getScratchSize(int maximumBlockSize) noexcept
+    {
+        return 3 * ScratchArena::getPaddedSize((size_t) maximumBlockSize);
+    }
+
+    void prepare(const dsp::ProcessSpec& spec)
+    {
+        sampleRate = spec.sampleRate;
+
+        log2Threshold.reset(sampleRate, 0.05);
+        slope.reset(sampleRate, 0.05);
+        maximumBlockSize = (int) spec.maximumBlockSize;
+
+        updateBallistics();
+        reset();
+    }
+
+    void reset()
+    {
+        envelope = 0.0f;
+        gainReduction = 0.0f;
+
+        log2Threshold.setCurrentAndTargetValue(log2Threshold.getTargetValue());
+        slope.setCurrentAndTargetValue(slope.getTargetValue());
+    }
+
+    void setThreshold(float thresholdDecibels) { log2Threshold.setTargetValue(thresholdDecibels * log2PerDecibel); }
+
+    void setRatio(float ratio)
+    {
+        jassert(ratio >= 1.0f);
+        slope.setTargetValue(1.0f / ratio - 1.0f);
+    }
+
+    void setAttack(float attackMilliseconds)
+    {
+        attackTime = attackMilliseconds;
+        updateBallistics();
+    }
+
+    void setRelease(float releaseMilliseconds)
+    {
+        releaseTime = releaseMilliseconds;
+        updateBallistics();
+    }
+
+    // The most gain reduction in the last block, in dB (0 or below).
+    float getGainReductionDecibels() const noexcept { return gainReduction; }
+
+    bool isSmoothing() const noexcept { return log2Threshold.isSmoothing() || slope.isSmoothing(); }
+
+    void process(const dsp::ProcessContextReplacing<float>& context, ScratchArena& arena)
+    {
+        const auto& outputBlock = context.getOutputBlock();
+        const auto numSamples = (int) outputBlock.getNumSamples();
+
+        // called before prepare(), which would leave the loop below without a step
+        if (maximumBlockSize <= 0)
+        {
+            jassertfalse;
+            return;
+        }
+
+        auto lowestGain = 1.0f;
+
+        for (int start = 0; start < numSamples; start += maximumBlockSize)
+        {
+            auto length = jmin(maximumBlockSize, numSamples - start);
+            const auto subBlock = outputBlock.getSubBlock((size_t) start, (size_t) length);
+
+            lowestGain = jmin(lowestGain, withChannelCount(subBlock.getNumChannels(), [&](auto channels) {
+                                  return processSubBlock<decltype(channels)::value>(subBlock, arena);
+                              }));
+        }
+
+        gainReduction = Decibels::gainToDecibels(lowestGain, -100.0f);
+    }
+
+private:
+    // log2(x) = dB / 20 * log2(10)
+    static constexpr float log2PerDecibel = 0.166096404f;
+
+    // Returns the lowest gain applied. Mono only takes the absolute values, and stereo finds the
+    // louder channel in one pass.
+    template <int NumChannels>
+    float processSubBlock(const dsp::AudioBlock<float>& block, ScratchArena& arena)
+    {
+        const auto numSamples = (int) block.getNumSamples();
+        const auto numChannels = getChannelCount<NumChannels>(block.getNumChannels());
+
+        if (numSamples == 0 || numChannels == 0)
+            return 1.0f;
+
+        ScratchArena::Scope scope(arena);
+
+        auto* gains = arena.allocate((size_t) numSamples);
+
+        if (gains == nullptr)
+            return 1.0f;
+
+        if (NumChannels == 2)
+        {
+            auto* left = block.getChannelPointer(0);
+            auto* right = block.getChannelPointer(1);
+
+            for (int i = 0; i < numSamples; ++i)
+                gains[i] = jmax(std::abs(left[i]), std::abs(right[i]));
+        }
+        else
+        {
+            FloatVectorOperations::abs(gains, block.getChannelPointer(0), numSamples);
+
+            for (size_t channel = 1; channel < numChannels; ++channel)
+            {
+                auto* samples = block.getChannelPointer(channel);
+
+                for (int i = 0; i < numSamples; ++i)
+                    gains[i] = jmax(gains[i], std::abs(samples[i]));
+            }
+        }
+
+        auto level = envelope;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const auto input = gains[i];
+            const auto coefficient = input > level ? attackCoefficient : releaseCoefficient;
+
+            level = input + coefficient * (level - input);
+            gains[i] = level;
+        }
+
+        envelope = level;
+
+        const auto thresholds = log2Threshold.getRamp(arena, numSamples);
+        const auto slopes = slope.getRamp(arena, numSamples);
+
+        if (thresholds.isConstant() && slopes.isConstant())
+        {
+            for (int i = 0; i < numSamples; ++i)
+                gains[i] = exp2(slopes.value * jmax(0.0f, log2(gains[i]) - thresholds.value));
+        }
+        else
+        {
+            for (int i = 0; i < numSamples; ++i)
+                gains[i] = exp2(slopes[i] * jmax(0.0f, log2(gains[i]) - thresholds[i]));
+        }
+
+        for (size_t channel = 0; channel < numChannels; ++channel)
+            FloatVectorOperations::multiply(block.getChannelPointer(channel), gains, numSamples);
+
+        return FloatVectorOperations::findMinimum(gains, numSamples);
+    }
+
+    // 2 / ln(2) * atanh((m - 1) / (m + 1)) on the mantissa, accurate to about 2e-5
+    static float log2(float x) noexcept
+    {
+        x = jmax(x, std::numeric_limits<float>::min());
+
+        uint32 bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+
+        const auto exponent = (float) ((int) (bits >> 23) - 127);
+        bits = (bits & 0x007fffffu) | 0x3f800000u;
+
+        float mantissa;
+        std::memcpy(&mantissa, &bits, sizeof(mantissa));
+
+        const auto s = (mantissa - 1.0f) / (mantissa + 1.0f);
+        const auto squared = s * s;
+
+        return exponent
+               + 2.88539008f * s
+                     * (1.0f
+                        + squared * (1.0f / 3.0f
+                        + squared * (1.0f / 5.0f
+                        + squared * (1.0f / 7.0f))));
+    }
+
+    // The Taylor polynomial on the fraction, scaled by the whole part in the exponent bits; accurate
+    // to about 1e-4 relative. Expects x <= 0.
+    static float exp2(float x) noexcept
+    {
+        x = jmax(x, -126.0f);
+
+        const auto whole = std::floor(x);
+        const auto fraction = x - whole;
+
+        const auto bits = (uint32) ((int) whole + 127) << 23;
+
+        float scale;
+        std::memcpy(&scale, &bits, sizeof(scale));
+
+        return scale
+               * (1.0f
+                  + fraction * (0.693147181f
+                  + fraction * (0.240226507f
+                  + fraction * (0.0555041087f
+                  + fraction * (0.00961812911f
+                  + fraction * 0.00133335581f)))));
+    }
+
+    // the one-pole coefficients of dsp::BallisticsFilter
+    void updateBallistics()
+    {
+        auto coefficient = [this](float timeMilliseconds) {
+            return timeMilliseconds < 1.0e-3f ? 0.0f : (float) std::exp(-MathConstants<double>::twoPi * 1000.0 / (sampleRate * timeMilliseconds));
+        };
+
+        attackCoefficient = coefficient(attackTime);
+        releaseCoefficient = coefficient(releaseTime);
+    }
+
+    double sampleRate = 44100.0;
+    int maximumBlockSize = 0;
+
+    BlockSmoother log2Threshold;
+    BlockSmoother slope;
+    float attackTime = 1.0f, releaseTime = 100.0f;
+    float attackCoefficient = 0.0f, releaseCoefficient = 0.0f;
+
+    float envelope = 0.0f;
+    float gainReduction = 0.0f;
+};
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "../ScratchArena.h"
+#include "BlockSmoother.h"
+
+#ifndef AMORPHETUDE_VERIFY_QUANTIZER
+#define AMORPHETUDE_VERIFY_QUANTIZER 0
+#endif
+
+// The bit crusher's core: dithers the signal and feeds the error of quantizing it back through a
+// peak filter, so the quantization noise is shaped around 3.75 kHz. The output itself is not
+// quantized, only the error is.
+//
+// The dither for the whole block comes from eight xorshift generators running side by side. The
+// error filters of all channels run in one SIMD register, and rounding uses the float mantissa
+// instead of std::round, so the per-sample loop has no calls and no branches.
+//
+// With AMORPHETUDE_VERIFY_QUANTIZER, every block is also run through the original scalar loop on
+// the same dither, and the two outputs are compared. getNumMismatches() counts the blocks that
+// differ, in release builds too.
+class NoiseShapedQuantizer
+{
+public:
+    NoiseShapedQuantizer()
+    {
+        Random seeds;
+
+        for (auto& generator : generators)
+            generator = (uint32) seeds.nextInt() | 1u;
+    }
+
+    // The scratch memory process() borrows, in samples.
+    static size_t getScratchSize(int numChannels, int maximumBlockSize) noexcept
+    {
+        auto size = ScratchArena::getBlockSize((size_t) numChannels, (size_t) maximumBlockSize)
+                    + ScratchArena::getPaddedSize((size_t) maximumBlockSize);
+
+#if AMORPHETUDE_VERIFY_QUANTIZER
+        size += ScratchArena::getBlockSize((size_t) numChannels, (size_t) maximumBlockSize);
+#endif
+
+        return size;
+    }
+
+    void prepare(const dsp::ProcessSpec& spec)
+    {
+        auto coefficients = dsp::IIR::Coefficients<float>::makePeakFilter(spec.sampleRate, 3750.0f, 10.0f, 0.1f)->coefficients;
+
+        for (size_t i = 0; i < filter.size(); ++i)
+            filter[i] = coefficients[(int) i];
+
+        maximumBlockSize = (int) spec.maximumBlockSize;
+        state.resize((spec.numChannels + laneCount - 1) / laneCount);
+
+        ditherGain.reset(spec.sampleRate, 0.05);
+
+        // the filter's poles sit at a radius of sqrt(a2), so its ringing falls by 120 dB in this long
+        settlingSamples = jmax(1, (int) std::ceil(std::log(1.0e-6) / (0.5 * std::log((double) filter[4]))));
+
+#if AMORPHETUDE_VERIFY_QUANTIZER
+        referenceState.resize(spec.numChannels);
+#endif
+
+        reset();
+    }
+
+    void reset()
+    {
+        for (auto& lanes : state)
+            lanes.fill(Lanes::expand(0.0f));
+
+#if AMORPHETUDE_VERIFY_QUANTIZER
+        for (auto& channelState : referenceState)
+            channelState.fill(0.0f);
+#endif
+    }
+
+    void setBitDepth(int numBits) { numSteps = (float) (1 << numBits); }
+
+    void setDitherGain(float gain) { ditherGain.setTargetValue(gain); }
+
+    bool isSmoothing() const noexcept { return ditherGain.isSmoothing(); }
+
+#if AMORPHETUDE_VERIFY_QUANTIZER
+    // How many blocks of any instance came out different from the reference loop. any thread
+    static uint64 getNumMismatches() noexcept { return numMismatches.load(std::memory_order_relaxed); }
+#endif
+
+    // How long the error filter keeps ringing once its input stops, in samples.
+    int getSettlingSamples() const noexcept { return settlingSamples; }
+
+    // Leaves a silent block as it is, without dither: moves the dither gain on and clears the error
+    // filter, so processing picks up from silence.
+    void skip(int numSamples) noexcept
+    {
+        ditherGain.advance(numSamples);
+        reset();
+    }
+
+    void process(const dsp::ProcessContextReplacing<float>& context, ScratchArena& arena)
+    {
+        const auto& outputBlock = context.getOutputBlock();
+        const auto numSamples = (int) outputBlock.getNumSamples();
+
+        if (maximumBlockSize <= 0)
+        {
+            jassertfalse;
+            return;
+        }
+
+        for (int start = 0; start < numSamples; start += maximumBlockSize)
+        {
+            auto length = jmin(maximumBlockSize, numSamples - start);
+            processSubBlock(outputBlock.getSubBlock((size_t) start, (size_t) length), arena);
+        }
+    }
+
+private:
+    using Lanes = dsp::SIMDRegister<float>;
+    static constexpr size_t laneCount = Lanes::size();
+    static constexpr size_t numGenerators = 8;
+
+    void processSubBlock(const dsp::AudioBlock<float>& block, ScratchArena& arena)
+    {
+        const auto numSamples = (int) block.getNumSamples();
+        const auto numChannels = block.getNumChannels();
+
+        ScratchArena::Scope scope(arena);
+
+        // without room for the dither, the block is only quantized
+        auto dither = arena.allocateBlock(numChannels, (size_t) numSamples);
+        const auto hasDither = dither.getNumChannels() > 0;
+
+        if (hasDither)
+            fillDither(dither, arena);
+        else
+            ditherGain.advance(numSamples);
+
+#if AMORPHETUDE_VERIFY_QUANTIZER
+        auto reference = hasDither ? arena.allocateBlock(numChannels, (size_t) numSamples) : dsp::AudioBlock<float>();
+        const auto isVerifying = reference.getNumChannels() > 0;
+
+        if (isVerifying)
+        {
+            reference.copyFrom(block);
+            processReference(reference, dither);
+        }
+#endif
+
+        if (hasDither)
+            block.add(dither);
+
+        for (size_t firstChannel = 0; firstChannel < numChannels; firstChannel += laneCount)
+            processLanes(block, firstChannel);
+
+#if AMORPHETUDE_VERIFY_QUANTIZER
+        if (isVerifying)
+            verify(block, reference);
+#endif
+    }
+
+    // uniform in [0, 1), like Random::nextFloat()
+    void fillNoise(float* dest, int numSamples) noexcept
+    {
+        float batch[numGenerators];
+
+        for (int i = 0; i < numSamples; i += (int) numGenerators)
+        {
+            for (size_t lane = 0; lane < numGenerators; ++lane)
+            {
+                auto x = generators[lane];
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                generators[lane] = x;
+
+                batch[lane] = (float) (x >> 8) * (1.0f / 16777216.0f);
+            }
+
+            std::copy(batch, batch + jmin((int) numGenerators, numSamples - i), dest + i);
+        }
+    }
+
+    void fillDither(const dsp::AudioBlock<float>& dither, ScratchArena& arena)
+    {
+        const auto numSamples = (int) dither.getNumSamples();
+
+        const auto gains = ditherGain.getRamp(arena, numSamples);
+
+        for (size_t channel = 0; channel < dither.getNumChannels(); ++channel)
+        {
+            fillNoise(dither.getChannelPointer(channel), numSamples);
+            gains.multiply(dither.getChannelPointer(channel), 0, numSamples);
+        }
+    }
+
+    // Expects the dither already added to the block.
+    void processLanes(const dsp::AudioBlock<float>& block, size_t firstChannel)
+    {
+        const auto numSamples = (int) block.getNumSamples();
+        const auto numLanes = jmin(laneCount, block.getNumChannels() - firstChannel);
+        auto& s = state[firstChannel / laneCount];
+
+        float* samples[laneCount] = {};
+
+        for (size_t lane = 0; lane < numLanes; ++lane)
+            samples[lane] = block.getChannelPointer(firstChannel + lane);
+
+        // adding and subtracting 1.5 * 2^23 leaves a float rounded to the nearest integer
+        const auto magic = Lanes::expand(12582912.0f);
+        const auto toSteps = Lanes::expand(0.5f * numSteps);
+        const auto fromSteps = Lanes::expand(2.0f / numSteps);
+        const auto one = Lanes::expand(1.0f);
+
+        const auto b0 = Lanes::expand(filter[0]);
+        const auto b1 = Lanes::expand(filter[1]);
+        const auto b2 = Lanes::expand(filter[2]);
+        const auto a1 = Lanes::expand(filter[3]);
+        const auto a2 = Lanes::expand(filter[4]);
+
+        alignas(Lanes::SIMDRegisterSize) float frame[laneCount] = {};
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            for (size_t lane = 0; lane < numLanes; ++lane)
+                frame[lane] = samples[lane][i];
+
+            const auto shaped = Lanes::fromRawArray(frame) + s[errorOut];
+            const auto quantized = ((shaped + one) * toSteps + magic - magic) * fromSteps - one;
+            const auto error = quantized - shaped;
+
+            s[errorOut] = b0 * error + s[delay1];
+            s[delay1] = b1 * error - a1 * s[errorOut] + s[delay2];
+            s[delay2] = b2 * error - a2 * s[errorOut];
+
+            shaped.copyToRawArray(frame);
+
+            for (size_t lane = 0; lane < numLanes; ++lane)
+                samples[lane][i] = frame[lane];
+        }
+    }
+
+#if AMORPHETUDE_VERIFY_QUANTIZER
+    // The processBlock loop this class replaced, on the same dither.
+    void processReference(const dsp::AudioBlock<float>& block, const dsp::AudioBlock<float>& dither)
+    {
+        for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+        {
+            auto* samples = block.getChannelPointer(channel);
+            auto* noise = dither.getChannelPointer(channel);
+            auto& s = referenceState[channel];
+
+            for (size_t i = 0; i < block.getNumSamples(); ++i)
+            {
+                samples[i] = samples[i] + s[errorOut] + noise[i];
+
+                auto error = bitReduction(samples[i]) - samples[i];
+                s[errorOut] = filter[0] * error + s[delay1];
+                s[delay1] = filter[1] * error - filter[3] * s[errorOut] + s[delay2];
+                s[delay2] = filter[2] * error - filter[4] * s[errorOut];
+            }
+        }
+    }
+
+    float bitReduction(float in) const
+    {
+        in = 0.5f * in + 0.5f;
+        in = numSteps * in;
+        in = std::round(in);
+
+        return 2.0f * in / numSteps - 1.0f;
+    }
+
+    // Leaves the difference in the reference block.
+    void verify(const dsp::AudioBlock<float>& block, const dsp::AudioBlock<float>& reference)
+    {
+        reference.subtract(block);
+
+        float maximumDifference = 0.0f;
+
+        for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+        {
+            auto range = FloatVectorOperations::findMinAndMax(reference.getChannelPointer(channel), (int) block.getNumSamples());
+            maximumDifference = jmax(maximumDifference, std::abs(range.getStart()), std::abs(range.getEnd()));
+        }
+
+        // only rounding ties may differ: std::round rounds them away from zero, the mantissa to even
+        if (maximumDifference > 1.0e-4f)
+        {
+            numMismatches.fetch_add(1, std::memory_order_relaxed);
+            jassertfalse;
+        }
+
+        // start the reference from the same state again, so one tie does not throw off later blocks
+        for (size_t channel = 0; channel < referenceState.size(); ++channel)
+        {
+            auto& s = state[channel / laneCount];
+
+            for (size_t part = 0; part < numStates; ++part)
+                referenceState[channel][part] = s[part].get(channel % laneCount);
+        }
+    }
+#endif
+
+    enum StatePart
+    {
+        errorOut,
+        delay1,
+        delay2,
+        numStates
+    };
+
+    std::array<float, 5> filter {};
+    int maximumBlockSize = 0;
+    int settlingSamples = 1;
+    float numSteps = (float) (1 << 10);
+
+    BlockSmoother ditherGain;
+    std::array<uint32, numGenerators> generators {};
+
+    std::vector<std::array<Lanes, numStates>> state;
+
+#if AMORPHETUDE_VERIFY_QUANTIZER
+    std::vector<std::array<float, numStates>> referenceState;
+    static inline std::atomic<uint64> numMismatches { 0 };
+#endif
+};
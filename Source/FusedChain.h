@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Plugins/ProcessorBase.h"
+
+// A fixed series chain of slot processors whose types are known at compile time.
+//
+// Every stage processes the same buffer in place, one after the other, with no graph bookkeeping in
+// between. Stages are held by value and the slot processors are final, so the compiler resolves the
+// processBlock calls statically and can inline the whole chain. Stages go idle on silence like the
+// slots of a dynamic chain do.
+template <typename... Processors>
+class FusedChain
+{
+public:
+    static constexpr size_t numStages = sizeof...(Processors);
+
+    template <size_t Index>
+    auto& get() noexcept
+    {
+        return std::get<Index>(stages);
+    }
+
+    template <typename Func>
+    void forEachStage(Func&& func)
+    {
+        std::apply([&](auto&... stage) { forEach(func, stage...); }, stages);
+    }
+
+    void prepare(double sampleRate, int samplesPerBlock, int numChannels, const std::array<bool, numStages>& bypassed)
+    {
+        size_t index = 0;
+
+        forEachStage([&](auto& stage) {
+            stage.setPlayConfigDetails(numChannels, numChannels, sampleRate, samplesPerBlock);
+            stage.prepareToPlay(sampleRate, samplesPerBlock);
+            stage.prepareBypass(numChannels, samplesPerBlock, bypassed[index++]);
+        });
+    }
+
+    void release()
+    {
+        forEachStage([](auto& stage) { stage.releaseResources(); });
+    }
+
+    void reset()
+    {
+        forEachStage([](auto& stage) { stage.reset(); });
+    }
+
+    void process(AudioBuffer<float>& buffer, MidiBuffer& midiMessages, const std::array<bool, numStages>& bypassed)
+    {
+        processStages(buffer, midiMessages, bypassed, std::index_sequence_for<Processors...>());
+    }
+
+    // For a silent block while every stage is idle, see ProcessorBase::skipSlot().
+    void skip(const AudioBuffer<float>& buffer, const std::array<bool, numStages>& bypassed)
+    {
+        size_t index = 0;
+
+        forEachStage([&](auto& stage) { stage.skipSlot(buffer.getNumSamples(), buffer.getNumChannels(), bypassed[index++]); });
+    }
+
+private:
+    template <size_t... Index>
+    void processStages(AudioBuffer<float>& buffer,
+                       MidiBuffer& midiMessages,
+                       const std::array<bool, numStages>& bypassed,
+                       std::index_sequence<Index...>)
+    {
+        (processStage(std::get<Index>(stages), buffer, midiMessages, bypassed[Index]), ...);
+    }
+
+    template <typename Processor>
+    static void processStage(Processor& stage, AudioBuffer<float>& buffer, MidiBuffer& midiMessages, bool isBypassed)
+    {
+        stage.processSlot(buffer, midiMessages, isBypassed);
+    }
+
+    std::tuple<Processors...> stages;
+};
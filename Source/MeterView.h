@@ -0,0 +1,153 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "PluginProcessor.h"
+
+// Level meters for each slot of the chain and for its output, and the output's spectrum.
+//
+// Polls the processor at display rate. Between readings, e.g. while the chain skips silent blocks,
+// the meters fall on their own.
+class MeterView : public Component, private Timer
+{
+public:
+    explicit MeterView(AmorphetudeAudioProcessor& processorToShow) : audioProcessor(processorToShow)
+    {
+        spectrum.fill(spectrumFloor);
+        startTimerHz(30);
+    }
+
+    void paint(Graphics& g) override
+    {
+        g.fillAll(getLookAndFeel().findColour(ResizableWindow::backgroundColourId).darker());
+
+        auto bounds = getLocalBounds().reduced(4);
+        auto meterArea = bounds.removeFromLeft(jmin(bounds.getWidth() / 2, meterWidth * (int) meters.size()));
+
+        for (auto& meter : meters)
+            paintMeter(g, meterArea.removeFromLeft(meterWidth).reduced(2, 0), meter);
+
+        paintSpectrum(g, bounds.reduced(4, 0).toFloat());
+    }
+
+private:
+    static constexpr int meterWidth = 64;
+    static constexpr float meterFloor = -60.0f;
+    static constexpr float spectrumFloor = -100.0f;
+
+    // about 20 dB per second at 30 Hz
+    static constexpr float fallPerFrame = 0.926f;
+
+    struct Meter
+    {
+        String name;
+        MeterReading reading;
+    };
+
+    void timerCallback() override
+    {
+        const auto numSlots = audioProcessor.getNumSlots();
+        meters.resize((size_t) numSlots + 1);
+
+        for (int index = 0; index <= numSlots; ++index)
+        {
+            auto& meter = meters[(size_t) index];
+            const auto isOutput = index == numSlots;
+
+            meter.name = isOutput ? "Output" : audioProcessor.getSlotName(index);
+
+            MeterReading reading;
+
+            if (isOutput ? audioProcessor.pullOutputMeter(reading) : audioProcessor.pullSlotMeter(index, reading))
+            {
+                meter.reading = reading;
+            }
+            else
+            {
+                meter.reading.peak *= fallPerFrame;
+                meter.reading.rms *= fallPerFrame;
+            }
+        }
+
+        audioProcessor.getSpectrum(spectrum);
+        repaint();
+    }
+
+    void paintMeter(Graphics& g, Rectangle<int> area, const Meter& meter)
+    {
+        auto labels = area.removeFromBottom(32);
+        auto bar = area.toFloat();
+
+        auto levelToY = [&](float gain) {
+            return jmap(jlimit(meterFloor, 0.0f, Decibels::gainToDecibels(gain, meterFloor)), meterFloor, 0.0f, bar.getBottom(), bar.getY());
+        };
+
+        g.setColour(Colours::black);
+        g.fillRect(bar);
+
+        g.setColour(Colours::limegreen);
+        g.fillRect(bar.withTop(levelToY(meter.reading.rms)));
+
+        g.setColour(meter.reading.peak >= 1.0f ? Colours::red : Colours::yellow);
+        g.fillRect(bar.withTop(levelToY(meter.reading.peak)).withHeight(2.0f));
+
+        g.setColour(Colours::white);
+        g.setFont(12.0f);
+        g.drawFittedText(meter.name, labels.removeFromTop(16), Justification::centred, 1);
+        g.drawFittedText(getValueText(meter), labels, Justification::centred, 1);
+    }
+
+    static String getValueText(const Meter& meter)
+    {
+        if (meter.name == PLUGIN_IDs::compressor.toString())
+            return String(meter.reading.value, 1) + " dB";
+
+        if (meter.name == PLUGIN_IDs::autowah.toString())
+            return String(roundToInt(meter.reading.value)) + " Hz";
+
+        return {};
+    }
+
+    // on a log frequency axis from 20 Hz to Nyquist
+    void paintSpectrum(Graphics& g, Rectangle<float> area)
+    {
+        g.setColour(Colours::black);
+        g.fillRect(area);
+
+        const auto sampleRate = audioProcessor.getSampleRate();
+
+        if (sampleRate <= 0.0)
+            return;
+
+        const auto lowest = 20.0;
+        const auto octaves = std::log2(0.5 * sampleRate / lowest);
+
+        Path path;
+
+        for (int bin = 1; bin < SpectrumAnalyzer::numBins; ++bin)
+        {
+            const auto frequency = bin * sampleRate / SpectrumAnalyzer::fftSize;
+
+            if (frequency < lowest)
+                continue;
+
+            const auto x = area.getX() + area.getWidth() * (float) (std::log2(frequency / lowest) / octaves);
+            const auto y = jmap(jmax(spectrumFloor, spectrum[(size_t) bin]), spectrumFloor, 0.0f, area.getBottom(), area.getY());
+
+            if (path.isEmpty())
+                path.startNewSubPath(x, y);
+            else
+                path.lineTo(x, y);
+        }
+
+        g.setColour(Colours::skyblue);
+        g.strokePath(path, PathStrokeType(1.5f));
+    }
+
+    AmorphetudeAudioProcessor& audioProcessor;
+
+    std::vector<Meter> meters;
+    SpectrumAnalyzer::Spectrum spectrum;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MeterView)
+};
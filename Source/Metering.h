@@ -0,0 +1,257 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// What a meter shows for one stretch of audio.
+struct MeterReading
+{
+    float peak = 0.0f;
+    float rms = 0.0f;
+
+    // the slot's own reading, e.g. the compressor's gain reduction in dB or the auto-wah's cutoff in Hz
+    float value = 0.0f;
+};
+
+// Peak and RMS levels, handed from the audio thread to the editor.
+//
+// The audio thread only adds each block to running totals, and pushes one reading into a lock-free
+// FIFO every 1 / readingsPerSecond seconds. If nobody pulls, readings are dropped rather than
+// queued up.
+class LevelMeter
+{
+public:
+    static constexpr double readingsPerSecond = 60.0;
+
+    // message thread, while the audio thread is stopped
+    void prepare(double sampleRate)
+    {
+        samplesPerReading = jmax(1, roundToInt(sampleRate / readingsPerSecond));
+        fifo.reset();
+
+        startReading();
+    }
+
+    // audio thread
+    void process(const AudioBuffer<float>& buffer, float value) noexcept
+    {
+        const auto numSamples = buffer.getNumSamples();
+
+        if (! buffer.hasBeenCleared())
+        {
+            for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+            {
+                auto* samples = buffer.getReadPointer(channel);
+                auto range = FloatVectorOperations::findMinAndMax(samples, numSamples);
+                auto squares = 0.0f;
+
+                for (int i = 0; i < numSamples; ++i)
+                    squares += samples[i] * samples[i];
+
+                peak = jmax(peak, -range.getStart(), range.getEnd());
+                sumOfSquares += squares;
+            }
+        }
+
+        addSamples(numSamples, buffer.getNumChannels(), value);
+    }
+
+    // A block that is known to be silent, at no cost. audio thread
+    void processSilence(int numSamples, int numChannels, float value) noexcept { addSamples(numSamples, numChannels, value); }
+
+    // The newest reading, with the highest peak of all readings since the last pull. Returns false
+    // when there has been none. message thread
+    bool pull(MeterReading& reading)
+    {
+        const auto numReady = fifo.getNumReady();
+
+        if (numReady == 0)
+            return false;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(numReady, start1, size1, start2, size2);
+
+        auto highestPeak = 0.0f;
+
+        for (int i = 0; i < size1; ++i)
+            highestPeak = jmax(highestPeak, readings[(size_t) (start1 + i)].peak);
+
+        for (int i = 0; i < size2; ++i)
+            highestPeak = jmax(highestPeak, readings[(size_t) (start2 + i)].peak);
+
+        reading = readings[(size_t) (size2 > 0 ? start2 + size2 - 1 : start1 + size1 - 1)];
+        reading.peak = highestPeak;
+
+        fifo.finishedRead(size1 + size2);
+        return true;
+    }
+
+private:
+    static constexpr int fifoSize = 32;
+
+    void startReading() noexcept
+    {
+        peak = 0.0f;
+        sumOfSquares = 0.0f;
+        numSamplesRead = 0;
+        numValuesRead = 0;
+    }
+
+    void addSamples(int numSamples, int numChannels, float value) noexcept
+    {
+        numSamplesRead += numSamples;
+        numValuesRead += numSamples * numChannels;
+
+        if (numSamplesRead < samplesPerReading)
+            return;
+
+        if (fifo.getFreeSpace() > 0)
+        {
+            int start1, size1, start2, size2;
+            fifo.prepareToWrite(1, start1, size1, start2, size2);
+
+            readings[(size_t) start1] = { peak, std::sqrt(sumOfSquares / (float) jmax(1, numValuesRead)), value };
+            fifo.finishedWrite(1);
+        }
+
+        startReading();
+    }
+
+    AbstractFifo fifo { fifoSize };
+    std::array<MeterReading, fifoSize> readings;
+
+    int samplesPerReading = 1;
+    float peak = 0.0f;
+    float sumOfSquares = 0.0f;
+    int numSamplesRead = 0;
+    int numValuesRead = 0;
+};
+
+// Spectra of the chain's output for an analyzer view.
+//
+// The audio thread only copies a mono mix of each block into a lock-free FIFO. A background thread
+// takes it from there, runs a windowed FFT every hopSize samples and keeps the newest spectrum for
+// the editor to copy.
+class SpectrumAnalyzer : private Thread
+{
+public:
+    static constexpr int fftOrder = 11;
+    static constexpr int fftSize = 1 << fftOrder;
+    static constexpr int hopSize = fftSize / 2;
+    static constexpr int numBins = fftSize / 2;
+
+    // Levels in dB, from DC up to just below Nyquist.
+    using Spectrum = std::array<float, (size_t) numBins>;
+
+    SpectrumAnalyzer() : Thread("Amorphetude analyzer")
+    {
+        newest.fill(floorDecibels);
+    }
+
+    ~SpectrumAnalyzer() override { stop(); }
+
+    // message thread
+    void start()
+    {
+        if (! isThreadRunning())
+            startThread(3);
+    }
+
+    // message thread
+    void stop() { stopThread(1000); }
+
+    // Drops what does not fit while the background thread is behind. audio thread
+    void push(const AudioBuffer<float>& buffer) noexcept
+    {
+        const auto numSamples = jmin(buffer.getNumSamples(), fifo.getFreeSpace());
+        const auto numChannels = buffer.getNumChannels();
+
+        if (numSamples == 0 || numChannels == 0)
+            return;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+
+        auto mix = [&](float* dest, int offset, int length) {
+            if (length == 0)
+                return;
+
+            FloatVectorOperations::copy(dest, buffer.getReadPointer(0, offset), length);
+
+            for (int channel = 1; channel < numChannels; ++channel)
+                FloatVectorOperations::add(dest, buffer.getReadPointer(channel, offset), length);
+
+            FloatVectorOperations::multiply(dest, 1.0f / (float) numChannels, length);
+        };
+
+        mix(samples.data() + start1, 0, size1);
+        mix(samples.data() + start2, size1, size2);
+
+        fifo.finishedWrite(size1 + size2);
+    }
+
+    // Copies the newest spectrum; returns false when there is nothing new. message thread
+    bool getSpectrum(Spectrum& dest)
+    {
+        const ScopedLock lock(spectrumLock);
+
+        if (! hasNewSpectrum)
+            return false;
+
+        dest = newest;
+        hasNewSpectrum = false;
+        return true;
+    }
+
+private:
+    static constexpr float floorDecibels = -100.0f;
+
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            while (fifo.getNumReady() >= hopSize)
+                readHop();
+
+            wait(10);
+        }
+    }
+
+    void readHop()
+    {
+        // the frame slides on by a hop
+        std::copy(frame.begin() + hopSize, frame.end(), frame.begin());
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(hopSize, start1, size1, start2, size2);
+
+        std::copy(samples.begin() + start1, samples.begin() + start1 + size1, frame.end() - hopSize);
+        std::copy(samples.begin() + start2, samples.begin() + start2 + size2, frame.end() - hopSize + size1);
+
+        fifo.finishedRead(size1 + size2);
+
+        std::copy(frame.begin(), frame.end(), transform.begin());
+        window.multiplyWithWindowingTable(transform.data(), (size_t) fftSize);
+        fft.performFrequencyOnlyForwardTransform(transform.data());
+
+        const ScopedLock lock(spectrumLock);
+
+        for (int bin = 0; bin < numBins; ++bin)
+            newest[(size_t) bin] = Decibels::gainToDecibels(transform[(size_t) bin] * (2.0f / (float) fftSize), floorDecibels);
+
+        hasNewSpectrum = true;
+    }
+
+    AbstractFifo fifo { 4 * fftSize };
+    std::array<float, 4 * fftSize> samples {};
+
+    // background thread only
+    dsp::FFT fft { fftOrder };
+    dsp::WindowingFunction<float> window { (size_t) fftSize, dsp::WindowingFunction<float>::hann, true };
+    std::array<float, fftSize> frame {};
+    std::array<float, 2 * fftSize> transform {};
+
+    // between the background thread and the editor, never the audio thread
+    CriticalSection spectrumLock;
+    Spectrum newest;
+    bool hasNewSpectrum = false;
+};
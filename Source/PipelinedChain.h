@@ -0,0 +1,339 @@
+#pragma once
+
+#include "Plugins/ProcessorBase.h"
+
+#if JUCE_INTEL
+#include <emmintrin.h>
+#endif
+
+// Runs a slot chain as a pipeline across threads.
+//
+// The slots are split into consecutive stages. In every step each stage works on what the stage
+// before it produced one step earlier, so all stages run at the same time: the audio thread runs
+// the first one and a realtime worker thread each of the others. Between stages sits a delay of
+// exactly maximumBlockSize samples, which keeps the hand-over sample accurate whatever block sizes
+// the host uses, and adds that much latency per stage after the first.
+//
+// The audio thread hands work over and waits for it through atomic counters only, and never waits
+// for a worker that has not started: a stage whose worker has not picked it up by the time the audio
+// thread has finished its own is run on the audio thread instead. Workers spin while blocks keep
+// coming, and park on an event once none has come for two blocks; the audio thread wakes them at
+// the start of the next block.
+class PipelinedChain
+{
+public:
+    explicit PipelinedChain(int numStagesToUse)
+    {
+        for (int i = 0; i < jmax(1, numStagesToUse); ++i)
+            stages.add(new Stage());
+    }
+
+    ~PipelinedChain() { release(); }
+
+    int getNumStages() const noexcept { return stages.size(); }
+
+    int getLatencyInSamples() const noexcept { return (stages.size() - 1) * blockSize; }
+
+    // Called on a worker thread as it starts and finishes each stage, e.g. so a checker can watch the
+    // workers the way it watches the audio thread.
+    using StageHook = void (*)(bool isStarting);
+
+    static void setWorkerStageHook(StageHook hook) noexcept { workerStageHook.store(hook); }
+
+    // message thread
+    void prepare(double sampleRate, int numChannels, int maximumBlockSize, size_t scratchSize)
+    {
+        release();
+
+        blockSize = jmax(1, maximumBlockSize);
+        numPreparedChannels = numChannels;
+        idleMilliseconds = jmax(1, roundToInt(2000.0 * blockSize / sampleRate));
+        boundProcessors = nullptr;
+
+        for (auto* stage : stages)
+        {
+            stage->work.setSize(numChannels, blockSize);
+            stage->delay.setSize(numChannels, blockSize);
+            stage->delay.clear();
+            stage->delayPosition = 0;
+            stage->arena.prepare(scratchSize);
+            stage->midi.ensureSize(256);
+        }
+
+        for (int index = 1; index < stages.size(); ++index)
+        {
+            auto* worker = workers.add(new Worker(*this, index));
+            worker->startThread(Thread::realtimeAudioPriority);
+        }
+    }
+
+    // message thread
+    void release()
+    {
+        for (auto* worker : workers)
+            worker->signalThreadShouldExit();
+
+        for (auto* stage : stages)
+            stage->wake.signal();
+
+        workers.clear();
+    }
+
+    // Runs the processors, with one bypass flag per processor.
+    template <size_t NumFlags>
+    void process(AudioBuffer<float>& buffer, const Array<ProcessorBase*>& processors, const std::array<bool, NumFlags>& bypassed)
+    {
+        jassert((size_t) processors.size() <= NumFlags);
+        jassert(workers.size() == stages.size() - 1);
+
+        if (workers.size() != stages.size() - 1)
+            return;
+
+        if (&processors != boundProcessors)
+            assignStages(processors);
+
+        for (int index = 1; index < stages.size(); ++index)
+        {
+            auto& stage = *stages.getUnchecked(index);
+
+            if (stage.isParked.exchange(false))
+                stage.wake.signal();
+        }
+
+        step.processors = &processors;
+        step.bypassed = bypassed.data();
+        step.numChannels = jmin(buffer.getNumChannels(), numPreparedChannels);
+
+        for (int start = 0; start < buffer.getNumSamples(); start += blockSize)
+        {
+            step.numSamples = jmin(blockSize, buffer.getNumSamples() - start);
+            processStep(buffer, start);
+        }
+    }
+
+private:
+    struct Stage
+    {
+        AudioBuffer<float> work;
+        // the stage's output on its way to the next stage, one step late
+        AudioBuffer<float> delay;
+        int delayPosition = 0;
+
+        ScratchArena arena;
+        MidiBuffer midi;
+        int firstSlot = 0, endSlot = 0;
+
+        // a job is claimed by whichever of its worker and the audio thread gets to it first
+        std::atomic<uint32> requested { 0 }, claimed { 0 }, completed { 0 };
+
+        WaitableEvent wake;
+        std::atomic<bool> isParked { false };
+    };
+
+    class Worker : public Thread
+    {
+    public:
+        Worker(PipelinedChain& chainToRun, int stageIndex)
+            : Thread("Amorphetude pipeline stage " + String(stageIndex)), chain(chainToRun), index(stageIndex)
+        {
+        }
+
+        ~Worker() override { stopThread(1000); }
+
+        void run() override
+        {
+            ScopedNoDenormals noDenormals;
+
+            auto& stage = *chain.stages.getUnchecked(index);
+            auto lastWork = Time::getMillisecondCounter();
+
+            while (! threadShouldExit())
+            {
+                if (chain.claim(stage))
+                {
+                    const auto hook = workerStageHook.load(std::memory_order_relaxed);
+
+                    if (hook != nullptr)
+                        hook(true);
+
+                    chain.runStage(index);
+
+                    if (hook != nullptr)
+                        hook(false);
+
+                    stage.completed.fetch_add(1, std::memory_order_release);
+                    lastWork = Time::getMillisecondCounter();
+                }
+                else if (Time::getMillisecondCounter() - lastWork < (uint32) chain.idleMilliseconds)
+                {
+                    for (int i = 0; i < spinsPerCheck; ++i)
+                        pause();
+                }
+                else
+                {
+                    stage.isParked.store(true);
+
+                    // a job requested before the flag went up would not wake the worker
+                    if (stage.requested.load() == stage.claimed.load())
+                        stage.wake.wait();
+
+                    stage.isParked.store(false);
+                    lastWork = Time::getMillisecondCounter();
+                }
+            }
+        }
+
+    private:
+        PipelinedChain& chain;
+        int index;
+    };
+
+    // What the stages work on in the current step, set by the audio thread before it hands over.
+    struct Step
+    {
+        const Array<ProcessorBase*>* processors = nullptr;
+        const bool* bypassed = nullptr;
+        int numChannels = 0, numSamples = 0;
+    };
+
+    static constexpr int spinsPerCheck = 64;
+
+    static void pause() noexcept
+    {
+#if JUCE_INTEL
+        _mm_pause();
+#elif JUCE_ARM && JUCE_MSVC
+        __yield();
+#elif JUCE_ARM
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    // Takes the stage's next job, if it has one nobody has taken yet.
+    static bool claim(Stage& stage) noexcept
+    {
+        auto job = stage.claimed.load(std::memory_order_relaxed);
+
+        return stage.requested.load() != job && stage.claimed.compare_exchange_strong(job, job + 1, std::memory_order_acq_rel);
+    }
+
+    // Splits a chain into the stages, and has each slot borrow from its stage's arena, since slots on
+    // different threads must not share one. A chain that is still in use keeps its address, so a new
+    // one never looks like the last.
+    void assignStages(const Array<ProcessorBase*>& processors)
+    {
+        const auto numSlots = processors.size();
+        const auto numStages = stages.size();
+
+        for (int index = 0; index < numStages; ++index)
+        {
+            auto& stage = *stages.getUnchecked(index);
+            stage.firstSlot = index * numSlots / numStages;
+            stage.endSlot = (index + 1) * numSlots / numStages;
+
+            for (int slot = stage.firstSlot; slot < stage.endSlot; ++slot)
+                processors.getUnchecked(slot)->setScratchArena(&stage.arena);
+        }
+
+        boundProcessors = &processors;
+    }
+
+    void processStep(AudioBuffer<float>& buffer, int start)
+    {
+        const auto numStages = stages.size();
+
+        for (int index = 0; index < numStages; ++index)
+        {
+            auto& stage = *stages.getUnchecked(index);
+
+            for (int channel = 0; channel < step.numChannels; ++channel)
+            {
+                if (index == 0)
+                    stage.work.copyFrom(channel, 0, buffer, channel, start, step.numSamples);
+                else
+                    readDelay(*stages.getUnchecked(index - 1), channel, stage.work.getWritePointer(channel));
+            }
+        }
+
+        for (int index = 1; index < numStages; ++index)
+            stages.getUnchecked(index)->requested.fetch_add(1);
+
+        runStage(0);
+
+        for (int index = 1; index < numStages; ++index)
+        {
+            auto& stage = *stages.getUnchecked(index);
+            const auto job = stage.requested.load(std::memory_order_relaxed);
+
+            // a worker that is running has had all of the first stage's time to pick its job up
+            for (int i = 0; i < spinsPerCheck && stage.claimed.load(std::memory_order_acquire) != job; ++i)
+                pause();
+
+            if (claim(stage))
+            {
+                runStage(index);
+                stage.completed.fetch_add(1, std::memory_order_release);
+            }
+
+            // the worker has started, and only has its own slots left to finish
+            while (stage.completed.load(std::memory_order_acquire) != job)
+                pause();
+        }
+
+        // the delays hand on what was read from them above, so the stages can write into them now
+        for (int index = 0; index < numStages - 1; ++index)
+            writeDelay(*stages.getUnchecked(index));
+
+        auto& last = *stages.getUnchecked(numStages - 1);
+
+        for (int channel = 0; channel < step.numChannels; ++channel)
+            buffer.copyFrom(channel, start, last.work, channel, 0, step.numSamples);
+    }
+
+    void runStage(int index)
+    {
+        auto& stage = *stages.getUnchecked(index);
+        AudioBuffer<float> block(stage.work.getArrayOfWritePointers(), step.numChannels, step.numSamples);
+
+        for (int slot = stage.firstSlot; slot < stage.endSlot; ++slot)
+            step.processors->getUnchecked(slot)->processSlot(block, stage.midi, step.bypassed[slot]);
+    }
+
+    void readDelay(const Stage& stage, int channel, float* dest) const
+    {
+        auto* delay = stage.delay.getReadPointer(channel);
+        const auto numFirst = jmin(step.numSamples, blockSize - stage.delayPosition);
+
+        FloatVectorOperations::copy(dest, delay + stage.delayPosition, numFirst);
+        FloatVectorOperations::copy(dest + numFirst, delay, step.numSamples - numFirst);
+    }
+
+    void writeDelay(Stage& stage)
+    {
+        const auto numFirst = jmin(step.numSamples, blockSize - stage.delayPosition);
+
+        for (int channel = 0; channel < step.numChannels; ++channel)
+        {
+            auto* delay = stage.delay.getWritePointer(channel);
+            auto* source = stage.work.getReadPointer(channel);
+
+            FloatVectorOperations::copy(delay + stage.delayPosition, source, numFirst);
+            FloatVectorOperations::copy(delay, source + numFirst, step.numSamples - numFirst);
+        }
+
+        stage.delayPosition = (stage.delayPosition + step.numSamples) % blockSize;
+    }
+
+    inline static std::atomic<StageHook> workerStageHook { nullptr };
+
+    OwnedArray<Stage> stages;
+    OwnedArray<Worker> workers;
+    Step step;
+
+    int blockSize = 0;
+    int numPreparedChannels = 0;
+    int idleMilliseconds = 1;
+    const Array<ProcessorBase*>* boundProcessors = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE(PipelinedChain)
+};
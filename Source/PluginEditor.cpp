@@ -2,29 +2,59 @@
 #include "PluginProcessor.h"
 
 AmorphetudeAudioProcessorEditor::AmorphetudeAudioProcessorEditor(AmorphetudeAudioProcessor& parent)
-    : GenericAudioProcessorEditor(parent), audioProcessor(parent)
+    : GenericAudioProcessorEditor(parent),
+      audioProcessor(parent),
+      meterView(parent),
+      effectSelectorAttachment(parent.getEffectSelector(), [this](float newValue) { showSlot((int) newValue); })
 {
-    setSize(600, 480);
+    addAndMakeVisible(meterView);
+    audioProcessor.setMeteringEnabled(true);
+    audioProcessor.addChangeListener(this);
+
+    setSize(600, 480 + meterHeight);
+
+    effectSelectorAttachment.sendInitialUpdate();
 }
 
 AmorphetudeAudioProcessorEditor::~AmorphetudeAudioProcessorEditor()
 {
+    audioProcessor.removeChangeListener(this);
+    audioProcessor.setMeteringEnabled(false);
 }
 
 void AmorphetudeAudioProcessorEditor::resized()
 {
     float parentHeight = (float) getChildren().getFirst()->getHeight();
-    auto& audioProcessorEditorMap = static_cast<AmorphetudeAudioProcessor*>(&audioProcessor)->getAudioProcessorEditorMap();
 
     auto bounds = getLocalBounds();
     bounds.removeFromTop(parentHeight);
 
-    for (auto& item : audioProcessorEditorMap)
-    {
-        if (findChildWithID(item.first) == nullptr)
-            addChildAndSetID(item.second, item.first);
+    meterView.setBounds(bounds.removeFromBottom(meterHeight));
+
+    if (slotEditor != nullptr)
+        slotEditor->setBounds(bounds);
+}
+
+void AmorphetudeAudioProcessorEditor::showSlot(int effectIndex)
+{
+    shownEffectIndex = effectIndex;
+    auto* slot = audioProcessor.getFirstSlot(effectIndex);
+
+    if (slot == shownSlot)
+        return;
+
+    // the old editor goes before the new one is created, so at most one exists at a time
+    slotEditor.reset();
+    shownSlot = slot;
 
-        item.second->setBounds(bounds);
-        item.second->setVisible(audioProcessor.getSelectedEffectName() == item.first);
+    if (shownSlot == nullptr)
+        return;
+
+    slotEditor.reset(shownSlot->createEditor());
+
+    if (slotEditor != nullptr)
+    {
+        addAndMakeVisible(*slotEditor);
+        resized();
     }
 }
@@ -2,9 +2,13 @@
 
 #include <JuceHeader.h>
 
+#include "MeterView.h"
 #include "PluginProcessor.h"
 
-class AmorphetudeAudioProcessorEditor : public GenericAudioProcessorEditor
+// The plugin's parameters, below them the editor of the selected effect's slot, and the meters at
+// the bottom. Only that one slot editor exists; switching effects deletes it and creates the next.
+// The processor meters only while the editor is open.
+class AmorphetudeAudioProcessorEditor : public GenericAudioProcessorEditor, private ChangeListener
 {
 public:
     AmorphetudeAudioProcessorEditor(AmorphetudeAudioProcessor&);
@@ -13,7 +17,22 @@ public:
     void resized() override;
 
 private:
+    void showSlot(int effectIndex);
+
+    // the chain changed, so the selected effect's first slot may be another one, or gone
+    void changeListenerCallback(ChangeBroadcaster*) override { showSlot(shownEffectIndex); }
+
+    static constexpr int meterHeight = 160;
+
     AmorphetudeAudioProcessor& audioProcessor;
+    MeterView meterView;
+
+    int shownEffectIndex = 0;
+    ProcessorBase* shownSlot = nullptr;
+    std::unique_ptr<AudioProcessorEditor> slotEditor;
+
+    // calls showSlot() on the message thread whenever the effect selector changes
+    ParameterAttachment effectSelectorAttachment;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AmorphetudeAudioProcessorEditor)
 };
@@ -1,13 +1,12 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 
-AmorphetudeAudioProcessor::AmorphetudeAudioProcessor()
+AmorphetudeAudioProcessor::AmorphetudeAudioProcessor(ChainMode mode)
 #ifndef JucePlugin_PreferredChannelConfigurations
     : AudioProcessor(BusesProperties()
                          .withInput("Input", AudioChannelSet::stereo(), true)
                          .withOutput("Output", AudioChannelSet::stereo(), true)),
 #endif
-      mainProcessor(new AudioProcessorGraph()),
       parameters(*this,
                  nullptr,
                  PLUGIN_IDs::amorphetude,
@@ -16,24 +15,33 @@ AmorphetudeAudioProcessor::AmorphetudeAudioProcessor()
                    std::make_unique<AudioParameterBool>(PARAMETER_IDs::autowahBypass, "Auto-Wah Bypass", false),
                    std::make_unique<AudioParameterBool>(PARAMETER_IDs::echoBypass, "Echo Bypass", false),
                    std::make_unique<AudioParameterBool>(PARAMETER_IDs::bitCrushingBypass, "Bit Crushing Bypass", true),
-                   std::make_unique<AudioParameterChoice>(PARAMETER_IDs::effectSelector, "Effect Selector", processorChoices, 0) })
+                   std::make_unique<AudioParameterChoice>(PARAMETER_IDs::effectSelector, "Effect Selector", processorChoices, 0),
+                   std::make_unique<AudioParameterInt>(PARAMETER_IDs::preset, "Preset", 0, PresetBank::maxNumPresets - 1, 0) })
 {
-    parameters.addParameterListener(PARAMETER_IDs::compressorBypass, this);
-    parameters.addParameterListener(PARAMETER_IDs::overdriveBypass, this);
-    parameters.addParameterListener(PARAMETER_IDs::autowahBypass, this);
-    parameters.addParameterListener(PARAMETER_IDs::echoBypass, this);
-    parameters.addParameterListener(PARAMETER_IDs::bitCrushingBypass, this);
-    parameters.addParameterListener(PARAMETER_IDs::effectSelector, this);
+    if (mode == ChainMode::fused)
+        fusedChain = std::make_unique<FusedEffectChain>();
+    else
+        createSlotPool();
 
-    parameterChanged(PARAMETER_IDs::compressorBypass, *parameters.getRawParameterValue(PARAMETER_IDs::compressorBypass));
-    parameterChanged(PARAMETER_IDs::overdriveBypass, *parameters.getRawParameterValue(PARAMETER_IDs::overdriveBypass));
-    parameterChanged(PARAMETER_IDs::autowahBypass, *parameters.getRawParameterValue(PARAMETER_IDs::autowahBypass));
-    parameterChanged(PARAMETER_IDs::echoBypass, *parameters.getRawParameterValue(PARAMETER_IDs::echoBypass));
-    parameterChanged(PARAMETER_IDs::bitCrushingBypass, *parameters.getRawParameterValue(PARAMETER_IDs::bitCrushingBypass));
+    if (mode == ChainMode::pipelined)
+        pipelinedChain = std::make_unique<PipelinedChain>(numPipelineStages);
+
+    forEachSlotProcessor([this](ProcessorBase& processor) { processor.setScratchArena(&scratchArena); });
+
+    parameters.addParameterListener(PARAMETER_IDs::preset, this);
+
+    bypassSnapshot.attach(parameters, bypassParameterIDs);
+
+    readBypassParameters();
+
+    addPreset("Default");
+
+    startTimer(100);
 }
 
 AmorphetudeAudioProcessor::~AmorphetudeAudioProcessor()
 {
+    stopTimer();
 }
 
 const String AmorphetudeAudioProcessor::getName() const
@@ -70,47 +78,175 @@ bool AmorphetudeAudioProcessor::isMidiEffect() const
 
 double AmorphetudeAudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    return tailSeconds.load(std::memory_order_relaxed);
+}
+
+void AmorphetudeAudioProcessor::updateTailLength()
+{
+    // the slots run in series, so their tails add up
+    double tail = 0.0;
+
+    forEachChainSlot([&](ProcessorBase& processor, size_t bypassIndex) {
+        if (parameters.getRawParameterValue(bypassParameterIDs[bypassIndex])->load() < 0.5f)
+            tail += processor.getTailLengthSeconds();
+    });
+
+    tailSeconds.store(tail, std::memory_order_relaxed);
 }
 
 int AmorphetudeAudioProcessor::getNumPrograms()
 {
-    return 1;
+    return jmax(1, presetBank.getNumPresets());
 }
 
 int AmorphetudeAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return (int) parameters.getRawParameterValue(PARAMETER_IDs::preset)->load();
 }
 
 void AmorphetudeAudioProcessor::setCurrentProgram(int index)
 {
+    if (! isPositiveAndBelow(index, presetBank.getNumPresets()))
+        return;
+
+    auto* parameter = parameters.getParameter(PARAMETER_IDs::preset);
+    parameter->setValueNotifyingHost(parameter->convertTo0to1((float) index));
+
+    // picking the same preset again still switches back to it
+    presetBank.select(index);
 }
 
 const String AmorphetudeAudioProcessor::getProgramName(int index)
 {
-    return {};
+    return presetBank.getName(index);
 }
 
 void AmorphetudeAudioProcessor::changeProgramName(int index, const String& newName)
 {
+    presetBank.setName(index, newName);
+}
+
+int AmorphetudeAudioProcessor::addPreset(const String& name)
+{
+    MemoryBlock state;
+    writeBinaryState(state, false);
+
+    return addPreset(name, state);
+}
+
+int AmorphetudeAudioProcessor::addPreset(const String& name, const MemoryBlock& state)
+{
+    const auto index = presetBank.add(name, state);
+
+    if (index >= 0)
+    {
+        publishPresets();
+        updateHostDisplay();
+    }
+
+    return index;
+}
+
+void AmorphetudeAudioProcessor::publishPresets()
+{
+    Array<AudioProcessorParameter*> presetParameters;
+    Array<HeldParameterValue*> heldValues;
+
+    for (auto* parameterID : bypassParameterIDs)
+    {
+        presetParameters.add(parameters.getParameter(parameterID));
+        heldValues.add(bypassSnapshot.findHeldValue(parameterID));
+    }
+
+    forEachChainSlot([&](ProcessorBase& processor, size_t) {
+        for (auto* parameter : processor.getParameters())
+        {
+            auto* withID = dynamic_cast<AudioProcessorParameterWithID*>(parameter);
+
+            presetParameters.add(parameter);
+            heldValues.add(withID != nullptr ? processor.findHeldValue(withID->paramID) : nullptr);
+        }
+    });
+
+    // the same matching as loading the state, with defaults for whatever it does not hold
+    presetBank.resolve(presetParameters, heldValues, [this](const BinaryState& state) {
+        std::vector<float> values;
+
+        auto addValue = [&](const Array<float>& saved, int index, AudioProcessorParameter& parameter) {
+            values.push_back(isPositiveAndBelow(index, saved.size()) ? saved.getUnchecked(index) : parameter.getDefaultValue());
+        };
+
+        for (auto* parameterID : bypassParameterIDs)
+        {
+            auto* parameter = parameters.getParameter(parameterID);
+            addValue(state.pluginValues, getParameters().indexOf(parameter), *parameter);
+        }
+
+        std::map<int, int> numFound;
+        const Array<float> noValues;
+
+        forEachChainSlot([&](ProcessorBase& processor, size_t) {
+            const auto effectIndex = getEffectIndex(processor);
+            auto* slot = findSlotState(state, effectIndex, numFound[effectIndex]++);
+            auto& saved = slot != nullptr ? slot->values : noValues;
+
+            for (int i = 0; i < processor.getParameters().size(); ++i)
+                addValue(saved, i, *processor.getParameters().getUnchecked(i));
+        });
+
+        return values;
+    });
 }
 
 void AmorphetudeAudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
 {
-    mainProcessor->setPlayConfigDetails(getMainBusNumInputChannels(),
-                                        getMainBusNumOutputChannels(),
-                                        sampleRate,
-                                        samplesPerBlock);
+    const auto scratchSize = getScratchArenaSize(samplesPerBlock);
+    scratchArena.prepare(scratchSize);
+
+    readBypassParameters();
+
+    if (fusedChain != nullptr)
+    {
+        fusedChain->prepare(sampleRate, samplesPerBlock, getMainBusNumInputChannels(), bypassParameters);
+    }
+    else
+    {
+        // the whole pool, so a slot inserted later is ready to run
+        for (auto* processor : slotPool)
+        {
+            processor->setPlayConfigDetails(getMainBusNumInputChannels(),
+                                            getMainBusNumOutputChannels(),
+                                            sampleRate,
+                                            samplesPerBlock);
+            processor->prepareToPlay(sampleRate, samplesPerBlock);
+            processor->prepareBypass(getMainBusNumInputChannels(), samplesPerBlock, bypassParameters[(size_t) getEffectIndex(*processor)]);
+        }
+
+        if (pipelinedChain != nullptr)
+            pipelinedChain->prepare(sampleRate, jmax(getTotalNumInputChannels(), getTotalNumOutputChannels()), samplesPerBlock, scratchSize);
 
-    mainProcessor->prepareToPlay(sampleRate, samplesPerBlock);
+        publishSlotChain();
+    }
 
-    initialiseGraph();
+    outputMeter.prepare(sampleRate);
+    updateTailLength();
+
+    chainLatency.store(getChainLatency(), std::memory_order_relaxed);
+    setLatencySamples(chainLatency.load(std::memory_order_relaxed));
 }
 
 void AmorphetudeAudioProcessor::releaseResources()
 {
-    mainProcessor->releaseResources();
+    if (fusedChain != nullptr)
+        fusedChain->release();
+
+    if (pipelinedChain != nullptr)
+        pipelinedChain->release();
+
+    for (auto* processor : slotPool)
+        processor->releaseResources();
+
+    slotChainPublisher.collectGarbage();
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -120,10 +256,11 @@ bool AmorphetudeAudioProcessor::isBusesLayoutSupported(const BusesLayout& layout
     juce::ignoreUnused(layouts);
     return true;
 #else
-    // This is the place where you check if the layout is supported.
-    // In this template code we only support mono or stereo.
-    if (layouts.getMainOutputChannelSet() != AudioChannelSet::mono()
-        && layouts.getMainOutputChannelSet() != AudioChannelSet::stereo())
+    // Any layout from mono up to 7.1.4 or third-order ambisonics; every slot processes as many
+    // channels as the bus has.
+    const auto numChannels = layouts.getMainOutputChannelSet().size();
+
+    if (numChannels < 1 || numChannels > ProcessorBase::maxNumChannels)
         return false;
 
 #if !JucePlugin_IsSynth
@@ -139,9 +276,162 @@ bool AmorphetudeAudioProcessor::isBusesLayoutSupported(const BusesLayout& layout
 
 void AmorphetudeAudioProcessor::processBlock(AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
 {
-    updateGraph();
+    ScopedNoDenormals noDenormals;
+
+    // a preset switch holds the parameters before anything reads them
+    presetBank.process();
+
+    readBypassParameters();
+
+    // a silent block through a chain of idle slots comes out as it went in, so the slots only take in
+    // bypass changes and meter the silence; a slot only counts as idle once its ramps have settled
+    auto isChainIdle = ProcessorBase::isSilent(buffer);
+
+    if (fusedChain != nullptr)
+    {
+        if (isChainIdle)
+            fusedChain->forEachStage([&](ProcessorBase& stage) { isChainIdle = isChainIdle && stage.isIdle(); });
+
+        if (isChainIdle)
+            fusedChain->skip(buffer, bypassParameters);
+        else
+            fusedChain->process(buffer, midiMessages, bypassParameters);
+
+        chainLatency.store(getChainLatency(), std::memory_order_relaxed);
+    }
+    else if (auto* chain = slotChainPublisher.acquire())
+    {
+        std::array<bool, maxNumSlots> slotBypassed {};
+        int latency = 0;
+
+        for (int i = 0; i < chain->processors.size(); ++i)
+        {
+            slotBypassed[(size_t) i] = bypassParameters[(size_t) chain->bypassIndices.getUnchecked(i)];
+            isChainIdle = isChainIdle && chain->processors.getUnchecked(i)->isIdle();
+            latency += chain->processors.getUnchecked(i)->getSlotLatency();
+        }
+
+        if (pipelinedChain != nullptr)
+        {
+            // the delays between the stages have to keep moving, silent or not
+            pipelinedChain->process(buffer, chain->processors, slotBypassed);
+            latency += pipelinedChain->getLatencyInSamples();
+        }
+        else if (isChainIdle)
+        {
+            for (int i = 0; i < chain->processors.size(); ++i)
+                chain->processors.getUnchecked(i)->skipSlot(buffer.getNumSamples(), buffer.getNumChannels(), slotBypassed[(size_t) i]);
+        }
+        else
+        {
+            for (int i = 0; i < chain->processors.size(); ++i)
+                chain->processors.getUnchecked(i)->processSlot(buffer, midiMessages, slotBypassed[(size_t) i]);
+        }
+
+        chainLatency.store(latency, std::memory_order_relaxed);
+    }
+
+    if (auto numDenormals = countDenormals(buffer))
+        denormalCount.fetch_add((uint64) numDenormals, std::memory_order_relaxed);
+
+    if (meteringEnabled.load(std::memory_order_relaxed))
+    {
+        outputMeter.process(buffer, 0.0f);
+        analyzer.push(buffer);
+    }
+}
+
+void AmorphetudeAudioProcessor::setMeteringEnabled(bool shouldMeter)
+{
+    forEachSlotProcessor([&](ProcessorBase& processor) { processor.setMeteringEnabled(shouldMeter); });
+    meteringEnabled.store(shouldMeter, std::memory_order_relaxed);
+
+    if (shouldMeter)
+        analyzer.start();
+    else
+        analyzer.stop();
+}
+
+bool AmorphetudeAudioProcessor::pullSlotMeter(int index, MeterReading& reading)
+{
+    auto hasReading = false;
+    int slot = 0;
+
+    forEachChainSlot([&](ProcessorBase& processor, size_t) {
+        if (slot++ == index)
+            hasReading = processor.pullMeterReading(reading);
+    });
+
+    return hasReading;
+}
+
+int AmorphetudeAudioProcessor::getNumSlots() const
+{
+    int numSlots = 0;
+    forEachChainSlot([&](ProcessorBase&, size_t) { ++numSlots; });
 
-    mainProcessor->processBlock(buffer, midiMessages);
+    return numSlots;
+}
+
+String AmorphetudeAudioProcessor::getSlotName(int index) const
+{
+    String name;
+    int slot = 0;
+
+    forEachChainSlot([&](ProcessorBase& processor, size_t) {
+        if (slot++ == index)
+            name = processor.getName();
+    });
+
+    return name;
+}
+
+bool AmorphetudeAudioProcessor::insertSlot(int index, const String& effectName)
+{
+    if (fusedChain != nullptr)
+        return false;
+
+    auto* processor = findUnusedSlot(effectName);
+
+    if (processor == nullptr)
+        return false;
+
+    // a pooled instance comes back as if it were new
+    for (auto* parameter : processor->getParameters())
+        parameter->setValueNotifyingHost(parameter->getDefaultValue());
+
+    processor->requestReset();
+
+    slotOrder.insert(index, processor);
+    publishSlotChain();
+
+    return true;
+}
+
+void AmorphetudeAudioProcessor::removeSlot(int index)
+{
+    if (fusedChain != nullptr || ! isPositiveAndBelow(index, slotOrder.size()))
+        return;
+
+    slotOrder.remove(index);
+    publishSlotChain();
+}
+
+void AmorphetudeAudioProcessor::moveSlot(int fromIndex, int toIndex)
+{
+    if (fusedChain != nullptr || ! isPositiveAndBelow(fromIndex, slotOrder.size()))
+        return;
+
+    slotOrder.move(fromIndex, toIndex);
+    publishSlotChain();
+}
+
+void AmorphetudeAudioProcessor::setNonRealtime(bool isNonRealtime) noexcept
+{
+    AudioProcessor::setNonRealtime(isNonRealtime);
+
+    // the slots pick their offline quality from it
+    forEachSlotProcessor([&](ProcessorBase& processor) { processor.setNonRealtime(isNonRealtime); });
 }
 
 bool AmorphetudeAudioProcessor::hasEditor() const
@@ -155,6 +445,31 @@ AudioProcessorEditor* AmorphetudeAudioProcessor::createEditor()
 }
 
 void AmorphetudeAudioProcessor::getStateInformation(MemoryBlock& destData)
+{
+    writeBinaryState(destData, true);
+}
+
+void AmorphetudeAudioProcessor::writeBinaryState(MemoryBlock& destData, bool includePresets)
+{
+    MemoryOutputStream stream(destData, false);
+
+    BinaryState::writeHeader(stream);
+    BinaryState::writeParameters(stream, getParameters());
+
+    int numSlots = 0;
+    forEachChainSlot([&](ProcessorBase&, size_t) { ++numSlots; });
+
+    BinaryState::writeSlotCount(stream, numSlots);
+
+    forEachChainSlot([&](ProcessorBase& processor, size_t) {
+        BinaryState::writeSlot(stream, getEffectIndex(processor), processor.getParameters());
+    });
+
+    if (includePresets)
+        presetBank.write(stream);
+}
+
+void AmorphetudeAudioProcessor::getXmlStateInformation(MemoryBlock& destData)
 {
     std::unique_ptr<XmlElement> xml(getPluginValueTree().createXml());
     copyXmlToBinary(*xml, destData);
@@ -162,15 +477,102 @@ void AmorphetudeAudioProcessor::getStateInformation(MemoryBlock& destData)
 
 void AmorphetudeAudioProcessor::setStateInformation(const void* data, int sizeInBytes)
 {
-    std::unique_ptr<XmlElement> xmlState(getXmlFromBinary(data, sizeInBytes));
+    // the state wins over a preset switch still on its way
+    isRestoringState = true;
+
+    if (BinaryState::isBinaryState(data, sizeInBytes))
+    {
+        BinaryState state;
+
+        if (state.read(data, sizeInBytes))
+            setBinaryState(state);
+    }
+    else
+    {
+        std::unique_ptr<XmlElement> xmlState(getXmlFromBinary(data, sizeInBytes));
+
+        if (xmlState.get() != nullptr)
+            setXmlState(*xmlState);
+    }
+
+    presetBank.cancel();
+    isRestoringState = false;
+}
+
+void AmorphetudeAudioProcessor::setBinaryState(const BinaryState& state)
+{
+    BinaryState::applyValues(getParameters(), state.pluginValues);
+
+    // slot states are applied here on the message thread, never from the audio thread
+    if (fusedChain == nullptr)
+    {
+        StringArray slotNames;
+
+        for (auto& slot : state.slots)
+            slotNames.add(processorChoices[slot.effectIndex]);
 
-    if (xmlState.get() != nullptr)
-        pluginValueTree = ValueTree::fromXml(*xmlState);
+        restoreSlotOrder(slotNames);
+    }
 
+    if (state.hasPresets)
+        presetBank.restore(state.presets);
+
+    std::map<int, int> numRestored;
+
+    forEachChainSlot([&](ProcessorBase& processor, size_t) {
+        const auto effectIndex = getEffectIndex(processor);
+
+        if (auto* slot = findSlotState(state, effectIndex, numRestored[effectIndex]++))
+            BinaryState::applyValues(processor.getParameters(), slot->values);
+    });
+
+    publishPresets();
+}
+
+void AmorphetudeAudioProcessor::setXmlState(const XmlElement& xml)
+{
+    ValueTree pluginValueTree = ValueTree::fromXml(xml);
     ValueTree childVT = pluginValueTree.getChildWithName(PLUGIN_IDs::amorphetude);
 
     if (childVT.isValid())
         parameters.replaceState(childVT);
+
+    // slot states are applied here on the message thread, never from the audio thread
+    if (fusedChain == nullptr)
+        restoreSlotOrder(StringArray::fromTokens(pluginValueTree.getProperty(slotOrderProperty).toString(), false));
+
+    // the n-th slot of an effect takes the n-th state saved for that effect
+    std::map<String, int> numRestored;
+
+    forEachChainSlot([&](ProcessorBase& processor, size_t) {
+        auto occurrence = numRestored[processor.getName()]++;
+
+        for (auto slotVT : pluginValueTree)
+        {
+            if (slotVT.hasType(processor.getName()) && occurrence-- == 0)
+            {
+                processor.updateParameters(slotVT);
+                break;
+            }
+        }
+    });
+}
+
+void AmorphetudeAudioProcessor::restoreSlotOrder(const StringArray& slotNames)
+{
+    slotOrder.clear();
+
+    // states saved before the chain could be edited hold one slot of each effect, in the default order
+    for (auto& name : slotNames.isEmpty() ? processorChoices : slotNames)
+    {
+        if (auto* processor = findUnusedSlot(name))
+        {
+            processor->requestReset();
+            slotOrder.add(processor);
+        }
+    }
+
+    publishSlotChain();
 }
 
 AudioProcessor* JUCE_CALLTYPE createPluginFilter()
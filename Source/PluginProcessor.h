@@ -2,19 +2,53 @@
 
 #include <map>
 
+#include "BinaryState.h"
+#include "FusedChain.h"
+#include "PipelinedChain.h"
 #include "Plugins/AutoWahProcessor.h"
 #include "Plugins/BitCrushingProcessor.h"
 #include "Plugins/CompressorProcessor.h"
 #include "Plugins/EchoProcessor.h"
 #include "Plugins/OverdriveProcessor.h"
+#include "PresetBank.h"
+#include "RealtimePublisher.h"
 
-class AmorphetudeAudioProcessor : public AudioProcessor, public AudioProcessorValueTreeState::Listener
+#ifndef AMORPHETUDE_FUSED_CHAIN
+#define AMORPHETUDE_FUSED_CHAIN 0
+#endif
+
+#ifndef AMORPHETUDE_PIPELINED_CHAIN
+#define AMORPHETUDE_PIPELINED_CHAIN 0
+#endif
+
+class AmorphetudeAudioProcessor : public AudioProcessor,
+                                  public AudioProcessorValueTreeState::Listener,
+                                  public ChangeBroadcaster,
+                                  private Timer
 {
 public:
-    using AudioGraphIOProcessor = AudioProcessorGraph::AudioGraphIOProcessor;
-    using Node = AudioProcessorGraph::Node;
+    using FusedEffectChain = FusedChain<CompressorProcessor, OverdriveProcessor, AutoWahProcessor, EchoProcessor, BitCrushingProcessor>;
+
+    // dynamic runs the slots from a SlotChain published by the message thread, fused runs them as a FusedChain,
+    // pipelined runs the published SlotChain as a PipelinedChain.
+    enum class ChainMode
+    {
+        dynamic,
+        fused,
+        pipelined
+    };
+
+    static constexpr ChainMode defaultChainMode = AMORPHETUDE_FUSED_CHAIN       ? ChainMode::fused
+                                                  : AMORPHETUDE_PIPELINED_CHAIN ? ChainMode::pipelined
+                                                                                : ChainMode::dynamic;
+
+    // Two stages cost one block of latency.
+    static constexpr int numPipelineStages = 2;
 
-    AmorphetudeAudioProcessor();
+    // How many slots of each effect a chain can hold.
+    static constexpr int slotInstancesPerType = 3;
+
+    explicit AmorphetudeAudioProcessor(ChainMode mode = defaultChainMode);
     ~AmorphetudeAudioProcessor() override;
 
     void prepareToPlay(double sampleRate, int samplesPerBlock) override;
@@ -26,6 +60,8 @@ public:
 
     void processBlock(AudioBuffer<float>&, MidiBuffer&) override;
 
+    void setNonRealtime(bool isNonRealtime) noexcept override;
+
     AudioProcessorEditor* createEditor() override;
     bool hasEditor() const override;
 
@@ -45,220 +81,318 @@ public:
     void getStateInformation(MemoryBlock& destData) override;
     void setStateInformation(const void* data, int sizeInBytes) override;
 
+    // The XML state that was saved before the binary one. setStateInformation() still reads it.
+    void getXmlStateInformation(MemoryBlock& destData);
+
     void parameterChanged(const String& parameterID, float newValue) override
     {
-        if (parameterID == PARAMETER_IDs::compressorBypass)
-            bypassParameters[0] = newValue > 0.5f ? true : false;
-        else if (parameterID == PARAMETER_IDs::overdriveBypass)
-            bypassParameters[1] = newValue > 0.5f ? true : false;
-        else if (parameterID == PARAMETER_IDs::autowahBypass)
-            bypassParameters[2] = newValue > 0.5f ? true : false;
-        else if (parameterID == PARAMETER_IDs::echoBypass)
-            bypassParameters[3] = newValue > 0.5f ? true : false;
-        else if (parameterID == PARAMETER_IDs::bitCrushingBypass)
-            bypassParameters[4] = newValue > 0.5f ? true : false;
-        else if (parameterID == PARAMETER_IDs::effectSelector)
-        {
-            selectedEffectIndex = (int) newValue;
-
-            for (auto& item : audioProcessorEditorMap)
-                item.second->setVisible(item.first == processorChoices[selectedEffectIndex]);
-        }
+        if (parameterID == PARAMETER_IDs::preset && ! isRestoringState.load())
+            presetBank.select((int) newValue);
     }
 
-    std::map<String, AudioProcessorEditor*>& getAudioProcessorEditorMap()
+    // Adds the current settings, or a state saved by getStateInformation(), as a preset; returns its
+    // program index, or -1 when the bank is full or the state cannot be read. A preset sets the
+    // bypass and slot parameters of the chain as it is, and switches at the start of the next block.
+    int addPreset(const String& name);
+    int addPreset(const String& name, const MemoryBlock& state);
+
+    // The editor edits the first slot of the selected effect in the chain.
+    RangedAudioParameter& getEffectSelector() { return *parameters.getParameter(PARAMETER_IDs::effectSelector); }
+
+    // The first slot of the effect in the chain, or nullptr when the chain has none. message thread
+    ProcessorBase* getFirstSlot(int effectIndex) const
     {
-        for (auto slot : slots)
-        {
-            if (slot != nullptr)
-            {
-                auto* processor = slot->getProcessor();
+        ProcessorBase* first = nullptr;
 
-                if (audioProcessorEditorMap.count(processor->getName()) == 0)
-                    audioProcessorEditorMap[processor->getName()] = processor->createEditor();
-            }
-        }
+        forEachChainSlot([&](ProcessorBase& processor, size_t) {
+            if (first == nullptr && getEffectIndex(processor) == effectIndex)
+                first = &processor;
+        });
 
-        return audioProcessorEditorMap;
+        return first;
     }
 
-    String getSelectedEffectName() { return processorChoices[selectedEffectIndex]; }
+    // The slot chain, edited on the message thread. Slots are taken from a pool of instances prepared
+    // along with the plugin, so editing the chain never allocates or prepares anything on the audio
+    // thread. The fused chain's order is fixed at compile time, so it cannot be edited. Change
+    // listeners hear about every new chain.
+    int getNumSlots() const;
+    String getSlotName(int index) const;
+    bool insertSlot(int index, const String& effectName);
+    void removeSlot(int index);
+    void moveSlot(int fromIndex, int toIndex);
+
+    // Metering costs the audio thread a pass over the output of each slot and of the chain, so it only
+    // runs while enabled, e.g. while the editor is open. The spectrum is computed on a background
+    // thread that only runs while metering. message thread
+    void setMeteringEnabled(bool shouldMeter);
+    bool pullOutputMeter(MeterReading& reading) { return outputMeter.pull(reading); }
+    bool pullSlotMeter(int index, MeterReading& reading);
+    bool getSpectrum(SpectrumAnalyzer::Spectrum& spectrum) { return analyzer.getSpectrum(spectrum); }
+
+    // Samples that left the chain denormal, which flushing them to zero should keep at none.
+    uint64 getDenormalCount() const noexcept { return denormalCount.load(std::memory_order_relaxed); }
 
 private:
-    void initialiseGraph()
+    // The order the slots run in, and the bypass parameter of each, which is shared by all slots of
+    // the same effect.
+    struct SlotChain
     {
-        mainProcessor->clear();
+        Array<ProcessorBase*> processors;
+        Array<int> bypassIndices;
+    };
 
-        audioInputNode = mainProcessor->addNode(std::make_unique<AudioGraphIOProcessor>(AudioGraphIOProcessor::audioInputNode));
-        audioOutputNode = mainProcessor->addNode(std::make_unique<AudioGraphIOProcessor>(AudioGraphIOProcessor::audioOutputNode));
-        midiInputNode = mainProcessor->addNode(std::make_unique<AudioGraphIOProcessor>(AudioGraphIOProcessor::midiInputNode));
-        midiOutputNode = mainProcessor->addNode(std::make_unique<AudioGraphIOProcessor>(AudioGraphIOProcessor::midiOutputNode));
-
-        connectAudioNodes();
-        connectMidiNodes();
+    static std::unique_ptr<ProcessorBase> createSlotProcessor(int effectIndex)
+    {
+        switch (effectIndex)
+        {
+            case compressorBypass:
+                return std::make_unique<CompressorProcessor>();
+            case overdriveBypass:
+                return std::make_unique<OverdriveProcessor>();
+            case autowahBypass:
+                return std::make_unique<AutoWahProcessor>();
+            case echoBypass:
+                return std::make_unique<EchoProcessor>();
+            case bitCrushingBypass:
+                return std::make_unique<BitCrushingProcessor>();
+            default:
+                break;
+        }
 
-        slots.add(slot1Node);
-        slots.add(slot2Node);
-        slots.add(slot3Node);
-        slots.add(slot4Node);
-        slots.add(slot5Node);
+        jassertfalse;
+        return {};
     }
 
-    void updateGraph()
+    // Every instance a chain may use is created up front; the chain starts with one of each effect.
+    void createSlotPool()
     {
-        bool hasChanged = false;
+        for (int effectIndex = 0; effectIndex < numBypassParameters; ++effectIndex)
+        {
+            for (int i = 0; i < slotInstancesPerType; ++i)
+                slotPool.add(createSlotProcessor(effectIndex));
 
-        hasChanged = createAndUpdateSlot<CompressorProcessor>(0, PLUGIN_IDs::compressor);
-        hasChanged = createAndUpdateSlot<OverdriveProcessor>(1, PLUGIN_IDs::overdrive);
-        hasChanged = createAndUpdateSlot<AutoWahProcessor>(2, PLUGIN_IDs::autowah);
-        hasChanged = createAndUpdateSlot<EchoProcessor>(3, PLUGIN_IDs::echo);
-        hasChanged = createAndUpdateSlot<BitCrushingProcessor>(4, PLUGIN_IDs::bitCrushing);
+            slotOrder.add(slotPool[slotPool.size() - slotInstancesPerType]);
+        }
+    }
 
-        if (hasChanged)
-        {
-            for (auto connection : mainProcessor->getConnections())
-                mainProcessor->removeConnection(connection);
+    // An instance of the effect that is not in the chain, or nullptr when they all are.
+    ProcessorBase* findUnusedSlot(const String& effectName) const
+    {
+        for (auto* processor : slotPool)
+            if (processor->getName() == effectName && ! slotOrder.contains(processor))
+                return processor;
+
+        return nullptr;
+    }
 
-            ReferenceCountedArray<Node> activeSlots;
+    void restoreSlotOrder(const StringArray& slotNames);
 
-            for (auto slot : slots)
-            {
-                if (slot != nullptr)
-                {
-                    activeSlots.add(slot);
-
-                    slot->getProcessor()->setPlayConfigDetails(getMainBusNumInputChannels(),
-                                                               getMainBusNumOutputChannels(),
-                                                               getSampleRate(),
-                                                               getBlockSize());
-                }
-            }
+    void writeBinaryState(MemoryBlock& destData, bool includePresets);
+    void setBinaryState(const BinaryState& state);
+    void setXmlState(const XmlElement& xml);
 
-            if (activeSlots.isEmpty())
-            {
-                connectAudioNodes();
-            }
-            else
-            {
-                for (int i = 0; i < activeSlots.size() - 1; ++i)
-                {
-                    for (int channel = 0; channel < 2; ++channel)
-                        mainProcessor->addConnection({ { activeSlots.getUnchecked(i)->nodeID, channel },
-                                                       { activeSlots.getUnchecked(i + 1)->nodeID, channel } });
-                }
-
-                for (int channel = 0; channel < 2; ++channel)
-                {
-                    mainProcessor->addConnection({ { audioInputNode->nodeID, channel },
-                                                   { activeSlots.getFirst()->nodeID, channel } });
-                    mainProcessor->addConnection({ { activeSlots.getLast()->nodeID, channel },
-                                                   { audioOutputNode->nodeID, channel } });
-                }
-            }
+    int getEffectIndex(const ProcessorBase& processor) const { return processorChoices.indexOf(processor.getName()); }
 
-            connectMidiNodes();
+    // Builds the chain on the message thread and hands it to the audio thread, which picks it up at the
+    // start of its next block.
+    void publishSlotChain()
+    {
+        auto chain = std::make_unique<SlotChain>();
 
-            for (auto node : mainProcessor->getNodes())
-                node->getProcessor()->enableAllBuses();
+        for (auto* processor : slotOrder)
+        {
+            chain->processors.add(processor);
+            chain->bypassIndices.add(getEffectIndex(*processor));
         }
 
-        slot1Node = slots.getUnchecked(0);
-        slot2Node = slots.getUnchecked(1);
-        slot3Node = slots.getUnchecked(2);
-        slot4Node = slots.getUnchecked(3);
-        slot5Node = slots.getUnchecked(4);
+        slotChainPublisher.publish(std::move(chain));
+        publishPresets();
+        updateTailLength();
+        sendChangeMessage();
+    }
 
-        // bypass setting
-        Node::Ptr slot;
+    // The slots on one thread run one after the other, so an arena only has to hold what the hungriest
+    // one borrows.
+    size_t getScratchArenaSize(int samplesPerBlock) const
+    {
+        const auto numChannels = jmax(getTotalNumInputChannels(), getTotalNumOutputChannels());
+        size_t size = 0;
 
-        for (int i = 0; i < slots.size(); ++i)
-        {
-            slot = slots.getUnchecked(i);
+        forEachSlotProcessor([&](ProcessorBase& processor) {
+            size = jmax(size, processor.getSlotScratchSize(numChannels, samplesPerBlock));
+        });
 
-            if (slot != nullptr)
-                slot->setBypassed(bypassParameters[i]);
-        }
+        return size;
     }
 
-    void connectAudioNodes()
+    // Bypassed slots keep their latency, so bypassing does not change it.
+    int getChainLatency() const
     {
-        for (int channel = 0; channel < 2; ++channel)
-            mainProcessor->addConnection({ { audioInputNode->nodeID, channel },
-                                           { audioOutputNode->nodeID, channel } });
+        int latency = 0;
+
+        forEachChainSlot([&](ProcessorBase& processor, size_t) { latency += processor.getSlotLatency(); });
+
+        if (pipelinedChain != nullptr)
+            latency += pipelinedChain->getLatencyInSamples();
+
+        return latency;
     }
 
-    void connectMidiNodes()
+    // The slots may change their latency while processing, and the audio thread may switch presets,
+    // but the host may only be told on the message thread.
+    void timerCallback() override
     {
-        mainProcessor->addConnection({ { midiInputNode->nodeID, AudioProcessorGraph::midiChannelIndex },
-                                       { midiOutputNode->nodeID, AudioProcessorGraph::midiChannelIndex } });
+        const auto latency = chainLatency.load(std::memory_order_relaxed);
+
+        if (latency != getLatencySamples())
+            setLatencySamples(latency);
+
+        presetBank.notifyHost();
+        updateTailLength();
     }
 
-    ValueTree getPluginValueTree()
+    // Denormals have an all zero exponent; looking at the bits still works with denormals-are-zero on.
+    static int countDenormals(const AudioBuffer<float>& buffer) noexcept
     {
-        ValueTree pluginVT { PLUGIN_IDs::PLUGIN_VALUE_TREE, {}, {} };
+        if (buffer.hasBeenCleared())
+            return 0;
 
-        for (auto slot : slots)
+        int count = 0;
+
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
         {
-            if (slot != nullptr)
-                pluginVT.appendChild(static_cast<ProcessorBase*>(slot->getProcessor())->getParametersValueTree(), nullptr);
-        }
+            auto* samples = buffer.getReadPointer(channel);
 
-        pluginVT.appendChild(parameters.copyState(), nullptr);
+            for (int i = 0; i < buffer.getNumSamples(); ++i)
+            {
+                uint32 bits;
+                std::memcpy(&bits, samples + i, sizeof(bits));
+                count += ((bits & 0x7f800000u) == 0 && (bits & 0x007fffffu) != 0) ? 1 : 0;
+            }
+        }
 
-        return pluginVT;
+        return count;
     }
 
-    template <typename Processor>
-    bool createAndUpdateSlot(int index, const Identifier& id)
+    // Every slot instance, in the chain or not.
+    template <typename Func>
+    void forEachSlotProcessor(Func&& func) const
     {
-        bool hasChanged = false;
-        Node::Ptr slot;
-        ValueTree childVT;
+        if (fusedChain != nullptr)
+        {
+            fusedChain->forEachStage([&](ProcessorBase& stage) { func(stage); });
+            return;
+        }
 
-        slot = slots.getUnchecked(index);
+        for (auto* processor : slotPool)
+            func(*processor);
+    }
 
-        if (slot == nullptr)
+    // The slots in chain order, with the index of their bypass parameter. Only the message thread
+    // may use it with a dynamic or pipelined chain.
+    template <typename Func>
+    void forEachChainSlot(Func&& func) const
+    {
+        if (fusedChain != nullptr)
         {
-            slots.set(index, mainProcessor->addNode(std::make_unique<Processor>()));
-            hasChanged = true;
+            size_t index = 0;
+            fusedChain->forEachStage([&](ProcessorBase& stage) { func(stage, index++); });
+            return;
         }
 
-        auto* processor = static_cast<ProcessorBase*>(slots.getUnchecked(index)->getProcessor());
-        childVT = pluginValueTree.getChildWithName(id);
+        for (auto* processor : slotOrder)
+            func(*processor, (size_t) getEffectIndex(*processor));
+    }
+
+    // The bypass parameters, in slot order.
+    enum BypassParameter
+    {
+        compressorBypass,
+        overdriveBypass,
+        autowahBypass,
+        echoBypass,
+        bitCrushingBypass,
+        numBypassParameters
+    };
+
+    static constexpr std::array<const char*, numBypassParameters> bypassParameterIDs { PARAMETER_IDs::compressorBypass,
+                                                                                        PARAMETER_IDs::overdriveBypass,
+                                                                                        PARAMETER_IDs::autowahBypass,
+                                                                                        PARAMETER_IDs::echoBypass,
+                                                                                        PARAMETER_IDs::bitCrushingBypass };
+
+    // The n-th slot of an effect takes the n-th slot state saved for that effect.
+    static const BinaryState::Slot* findSlotState(const BinaryState& state, int effectIndex, int occurrence)
+    {
+        for (auto& slot : state.slots)
+            if (slot.effectIndex == effectIndex && occurrence-- == 0)
+                return &slot;
+
+        return nullptr;
+    }
+
+    // Decodes the presets again for the parameters of the chain's slots.
+    void publishPresets();
+
+    // Works out the chain's tail for getTailLengthSeconds(), which hosts may call from any thread.
+    // message thread
+    void updateTailLength();
+
+    void readBypassParameters()
+    {
+        bypassSnapshot.update([this](size_t index, float newValue) { bypassParameters[index] = newValue > 0.5f; });
+    }
+
+    ValueTree getPluginValueTree()
+    {
+        ValueTree pluginVT { PLUGIN_IDs::PLUGIN_VALUE_TREE, {}, {} };
+        StringArray slotNames;
+
+        // one child per slot, in chain order
+        forEachChainSlot([&](ProcessorBase& processor, size_t) {
+            slotNames.add(processor.getName());
+            pluginVT.appendChild(processor.getParametersValueTree(), nullptr);
+        });
 
-        if (childVT.isValid() && processor->isParametersUpdated() == false)
-            processor->updateParameters(childVT);
+        pluginVT.setProperty(slotOrderProperty, slotNames.joinIntoString(" "), nullptr);
 
-        return hasChanged;
+        pluginVT.appendChild(parameters.copyState(), nullptr);
+
+        return pluginVT;
     }
 
-    std::array<bool, 5> bypassParameters;
-    int selectedEffectIndex = 0;
+    std::array<bool, numBypassParameters> bypassParameters;
     StringArray processorChoices { PLUGIN_IDs::compressor.toString(),
                                    PLUGIN_IDs::overdrive.toString(),
                                    PLUGIN_IDs::autowah.toString(),
                                    PLUGIN_IDs::echo.toString(),
                                    PLUGIN_IDs::bitCrushing.toString() };
 
-    ValueTree pluginValueTree;
     AudioProcessorValueTreeState parameters;
+    ParameterSnapshot<numBypassParameters> bypassSnapshot;
 
-    Node::Ptr audioInputNode;
-    Node::Ptr audioOutputNode;
-    Node::Ptr midiInputNode;
-    Node::Ptr midiOutputNode;
+    PresetBank presetBank;
+    // keeps the preset parameter being restored from switching presets
+    std::atomic<bool> isRestoringState { false };
 
-    ReferenceCountedArray<Node> slots;
+    static constexpr const char* slotOrderProperty = "slotOrder";
+    static constexpr int maxNumSlots = numBypassParameters * slotInstancesPerType;
 
-    Node::Ptr slot1Node;
-    Node::Ptr slot2Node;
-    Node::Ptr slot3Node;
-    Node::Ptr slot4Node;
-    Node::Ptr slot5Node;
+    OwnedArray<ProcessorBase> slotPool;
+    Array<ProcessorBase*> slotOrder;
+    RealtimePublisher<SlotChain> slotChainPublisher;
+    ScratchArena scratchArena;
+    std::atomic<int> chainLatency { 0 };
+    std::atomic<double> tailSeconds { 0.0 };
+    std::atomic<uint64> denormalCount { 0 };
 
-    std::map<String, AudioProcessorEditor*> audioProcessorEditorMap;
+    std::atomic<bool> meteringEnabled { false };
+    LevelMeter outputMeter;
+    SpectrumAnalyzer analyzer;
 
-    std::unique_ptr<AudioProcessorGraph> mainProcessor;
+    std::unique_ptr<FusedEffectChain> fusedChain;
+    std::unique_ptr<PipelinedChain> pipelinedChain;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AmorphetudeAudioProcessor)
 };
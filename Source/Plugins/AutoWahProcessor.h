@@ -1,6 +1,7 @@
+#include "../DSP/AutoWahFilter.h"
 #include "ProcessorBase.h"
 
-class AutoWahProcessor : public ProcessorBase, public AudioProcessorValueTreeState::Listener
+class AutoWahProcessor final : public ProcessorBase
 {
 public:
     AutoWahProcessor()
@@ -13,110 +14,64 @@ public:
                        std::make_unique<AudioParameterFloat>(PARAMETER_IDs::autowahFrom, "Auto-Wah From", NormalisableRange<float>(20.0f, 22000.0f, 0.0f, 0.25f), 500.0f, "Hz"),
                        std::make_unique<AudioParameterFloat>(PARAMETER_IDs::autowahTo, "Auto-Wah To", NormalisableRange<float>(20.0f, 22000.0f, 0.0f, 0.25f), 3000.0f, "Hz") })
     {
-        parameters.addParameterListener(PARAMETER_IDs::autowahMode, this);
-        parameters.addParameterListener(PARAMETER_IDs::autowahTempo, this);
-        parameters.addParameterListener(PARAMETER_IDs::autowahRatio, this);
-        parameters.addParameterListener(PARAMETER_IDs::autowahFrom, this);
-        parameters.addParameterListener(PARAMETER_IDs::autowahTo, this);
-
-        parameterChanged(PARAMETER_IDs::autowahMode, *parameters.getRawParameterValue(PARAMETER_IDs::autowahMode));
-        parameterChanged(PARAMETER_IDs::autowahTempo, *parameters.getRawParameterValue(PARAMETER_IDs::autowahTempo));
-        parameterChanged(PARAMETER_IDs::autowahRatio, *parameters.getRawParameterValue(PARAMETER_IDs::autowahRatio));
-        parameterChanged(PARAMETER_IDs::autowahFrom, *parameters.getRawParameterValue(PARAMETER_IDs::autowahFrom));
-        parameterChanged(PARAMETER_IDs::autowahTo, *parameters.getRawParameterValue(PARAMETER_IDs::autowahTo));
-
-        ladder.setCutoffFrequencyHz(autowahFrom);
-        ladder.setResonance(0.7f);
+        snapshot.attach(parameters,
+                        { PARAMETER_IDs::autowahMode,
+                          PARAMETER_IDs::autowahTempo,
+                          PARAMETER_IDs::autowahRatio,
+                          PARAMETER_IDs::autowahFrom,
+                          PARAMETER_IDs::autowahTo });
+
+        readParameters();
+
+        wahFilter.setResonance(0.7f);
     }
 
     void prepareToPlay(double sampleRate, int samplesPerBlock) override
     {
-        dsp::ProcessSpec spec { sampleRate, static_cast<uint32>(samplesPerBlock), 2 };
+        auto spec = getProcessSpec(sampleRate, samplesPerBlock);
+
+        prepareAll(spec, wahFilter);
+        prepareScratch((int) spec.numChannels, samplesPerBlock);
 
-        prepareAll(spec, ladder);
+        // the cutoff moves about every 0.7 ms whatever the sample rate, i.e. every 32 samples at 48 kHz
+        wahFilter.setControlInterval(jmax(1, roundToInt(sampleRate / 1500.0)));
+
+        snapshot.invalidate();
+        readParameters();
 
         reset();
     }
 
     void processBlock(AudioBuffer<float>& buffer, MidiBuffer&) override
     {
-        dsp::AudioBlock<float> block(buffer);
-        dsp::ProcessContextReplacing<float> context(block);
-
-        const auto& inputBlock = context.getInputBlock();
-        const auto& outputBlock = context.getOutputBlock();
-        const auto numSamples = inputBlock.getNumSamples();
-
-        float wahTime = 60.0f / autowahTempo * autowahRatio;
-        float alpha = std::exp(-std::log(9) / (getSampleRate() * wahTime));
-
-        for (size_t i = 0; i < numSamples; ++i)
-        {
-            // assume the attack of audio channel 0 decide auto-wah effect
-            absInput = std::abs(inputBlock.getSample(0, (int) i));
-
-            wahEnv = (1.0f - alpha) * absInput + alpha * lastWahEnv;
-
-            smoothCutoffFreqHz = jmin(autowahFrom + wahEnv * autowahTo, autowahTo);
+        readParameters();
 
-            lastWahEnv = wahEnv;
+        wahFilter.setEnvelopeTime(60.0f / autowahTempo * autowahRatio);
+        wahFilter.setRange(autowahFrom, autowahTo);
 
-            ladder.setCutoffFrequencyHz(smoothCutoffFreqHz);
-
-            auto block = outputBlock.getSubBlock(i, 1);
-            dsp::ProcessContextReplacing<float> autowahContext(block);
-            ladder.process(autowahContext);
-        }
+        dsp::AudioBlock<float> block(buffer);
+        wahFilter.process(dsp::ProcessContextReplacing<float>(block));
     }
 
     void reset() override
     {
-        resetAll(ladder);
+        wahFilter.setRange(autowahFrom, autowahTo);
 
-        absInput = 0.0f;
-        wahEnv = 0.0f;
-        lastWahEnv = 0.0f;
+        resetAll(wahFilter);
     }
 
+    // the resonance rings out well within this
+    int getTailSamples() const override { return roundToInt(0.1 * getSampleRate()); }
+
+    float getMeterValue() const noexcept override { return wahFilter.getCutoff(); }
+
+    bool isSmoothing() const noexcept override { return wahFilter.isSmoothing(); }
+
     AudioProcessorEditor* createEditor() override { return new GenericAudioProcessorEditor(*this); }
     bool hasEditor() const override { return true; }
 
     const String getName() const override { return PLUGIN_IDs::autowah.toString(); }
 
-    void parameterChanged(const String& parameterID, float newValue) override
-    {
-        if (parameterID == PARAMETER_IDs::autowahMode)
-            ladder.setMode([&] {
-                switch ((int) newValue)
-                {
-                    case 0:
-                        return dsp::LadderFilterMode::LPF12;
-                    case 1:
-                        return dsp::LadderFilterMode::LPF24;
-                    case 2:
-                        return dsp::LadderFilterMode::BPF12;
-                    case 3:
-                        return dsp::LadderFilterMode::BPF24;
-                    case 4:
-                        return dsp::LadderFilterMode::HPF12;
-                    case 5:
-                        return dsp::LadderFilterMode::HPF24;
-                    default:
-                        break;
-                }
-
-                return dsp::LadderFilterMode::BPF12;
-            }());
-        else if (parameterID == PARAMETER_IDs::autowahTempo)
-            autowahTempo = newValue;
-        else if (parameterID == PARAMETER_IDs::autowahRatio)
-            autowahRatio = newValue;
-        else if (parameterID == PARAMETER_IDs::autowahFrom)
-            autowahFrom = newValue;
-        else if (parameterID == PARAMETER_IDs::autowahTo)
-            autowahTo = newValue;
-    }
-
     ValueTree getParametersValueTree() override
     {
         return parameters.copyState();
@@ -125,22 +80,80 @@ public:
     void updateParameters(ValueTree& valueTree) override
     {
         parameters.replaceState(valueTree);
-        parametersUpdated = true;
     }
 
+    HeldParameterValue* findHeldValue(const String& parameterID) override { return snapshot.findHeldValue(parameterID); }
+
 private:
-    AudioProcessorValueTreeState parameters;
+    enum Parameter
+    {
+        mode,
+        tempo,
+        ratio,
+        from,
+        to,
+        numParameters
+    };
+
+    void readParameters()
+    {
+        snapshot.update([this](size_t index, float newValue) { parameterChanged(index, newValue); });
+    }
+
+    void parameterChanged(size_t index, float newValue)
+    {
+        switch (index)
+        {
+            case mode:
+                wahFilter.setMode(getLadderMode((int) newValue));
+                break;
+            case tempo:
+                autowahTempo = newValue;
+                break;
+            case ratio:
+                autowahRatio = newValue;
+                break;
+            case from:
+                autowahFrom = newValue;
+                break;
+            case to:
+                autowahTo = newValue;
+                break;
+            default:
+                break;
+        }
+    }
+
+    static dsp::LadderFilterMode getLadderMode(int choice)
+    {
+        switch (choice)
+        {
+            case 0:
+                return dsp::LadderFilterMode::LPF12;
+            case 1:
+                return dsp::LadderFilterMode::LPF24;
+            case 2:
+                return dsp::LadderFilterMode::BPF12;
+            case 3:
+                return dsp::LadderFilterMode::BPF24;
+            case 4:
+                return dsp::LadderFilterMode::HPF12;
+            case 5:
+                return dsp::LadderFilterMode::HPF24;
+            default:
+                break;
+        }
 
-    dsp::LadderFilter<float> ladder;
+        return dsp::LadderFilterMode::BPF12;
+    }
 
-    float smoothCutoffFreqHz;
+    AudioProcessorValueTreeState parameters;
+    ParameterSnapshot<numParameters> snapshot;
+
+    AutoWahFilter wahFilter;
 
     float autowahTempo;
     float autowahRatio;
     float autowahFrom;
     float autowahTo;
-
-    float absInput;
-    float wahEnv;
-    float lastWahEnv;
 };
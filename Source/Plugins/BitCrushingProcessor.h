@@ -1,6 +1,7 @@
+#include "../DSP/NoiseShapedQuantizer.h"
 #include "ProcessorBase.h"
 
-class BitCrushingProcessor : public ProcessorBase, public AudioProcessorValueTreeState::Listener
+class BitCrushingProcessor final : public ProcessorBase
 {
 public:
     BitCrushingProcessor()
@@ -10,55 +11,53 @@ public:
                      { std::make_unique<AudioParameterChoice>(PARAMETER_IDs::bitCrushingDepth, "Bit Crushing Depth", StringArray { "8", "10", "12" }, 1),
                        std::make_unique<AudioParameterFloat>(PARAMETER_IDs::bitCrushingDitherNoise, "Bit Crushing Dither Noise", NormalisableRange<float>(-100.0f, 0.0f), -60.0f, "dB") })
     {
-        parameters.addParameterListener(PARAMETER_IDs::bitCrushingDepth, this);
-        parameters.addParameterListener(PARAMETER_IDs::bitCrushingDitherNoise, this);
+        snapshot.attach(parameters,
+                        { PARAMETER_IDs::bitCrushingDepth,
+                          PARAMETER_IDs::bitCrushingDitherNoise });
 
-        parameterChanged(PARAMETER_IDs::bitCrushingDitherNoise, *parameters.getRawParameterValue(PARAMETER_IDs::bitCrushingDitherNoise));
+        readParameters();
     }
 
     void prepareToPlay(double sampleRate, int samplesPerBlock) override
     {
-        coefficients = FilterCoefs::makePeakFilter(sampleRate, 3750.0f, 10.0f, 0.1f)->coefficients;
+        auto spec = getProcessSpec(sampleRate, samplesPerBlock);
 
-        reset();
+        prepareAll(spec, quantizer);
+        prepareScratch((int) spec.numChannels, samplesPerBlock);
 
-        ditherNoise.reset(sampleRate, 0.05);
+        snapshot.invalidate();
+        readParameters();
     }
 
     void processBlock(AudioBuffer<float>& buffer, MidiBuffer&) override
     {
-        dsp::AudioBlock<float> block(buffer);
-        dsp::ProcessContextReplacing<float> context(block);
+        readParameters();
 
-        const auto& inputBlock = context.getInputBlock();
-        const auto& outputBlock = context.getOutputBlock();
-        const auto numSamples = inputBlock.getNumSamples();
-        const auto numChannels = inputBlock.getNumChannels();
+        // the dither stops once the input has been silent for longer than the noise shaper rings, so
+        // the slot can fall idle
+        silentInputSamples = isSilent(buffer) ? silentInputSamples + buffer.getNumSamples() : 0;
 
-        for (size_t channel = 0; channel < numChannels; ++channel)
+        if (silentInputSamples > (int64) quantizer.getSettlingSamples())
         {
-            auto* inputSamples = inputBlock.getChannelPointer(channel);
-            auto* outputSamples = outputBlock.getChannelPointer(channel);
-
-            float lastErrorIn = 0.0f;
-
-            for (size_t i = 0; i < numSamples; ++i)
-            {
-                outputSamples[i] = inputSamples[i] + lastErrorOut[channel] + ditherNoise.getNextValue() * random.nextFloat();
-
-                lastErrorIn = bitReduction(outputSamples[i]) - outputSamples[i];
-                lastErrorOut[channel] = coefficients[0] * lastErrorIn + errorDelay1[channel];
-                errorDelay1[channel] = coefficients[1] * lastErrorIn - coefficients[3] * lastErrorOut[channel] + errorDelay2[channel];
-                errorDelay2[channel] = coefficients[2] * lastErrorIn - coefficients[4] * lastErrorOut[channel];
-            }
+            quantizer.skip(buffer.getNumSamples());
+            return;
         }
+
+        dsp::AudioBlock<float> block(buffer);
+        quantizer.process(dsp::ProcessContextReplacing<float>(block), getScratchArena());
     }
 
     void reset() override
     {
-        std::fill(lastErrorOut.begin(), lastErrorOut.end(), 0.0f);
-        std::fill(errorDelay1.begin(), errorDelay1.end(), 0.0f);
-        std::fill(errorDelay2.begin(), errorDelay2.end(), 0.0f);
+        resetAll(quantizer);
+        silentInputSamples = 0;
+    }
+
+    bool isSmoothing() const noexcept override { return quantizer.isSmoothing(); }
+
+    size_t getScratchSize(int numChannels, int maximumBlockSize) const override
+    {
+        return NoiseShapedQuantizer::getScratchSize(numChannels, maximumBlockSize);
     }
 
     AudioProcessorEditor* createEditor() override { return new GenericAudioProcessorEditor(*this); }
@@ -66,14 +65,6 @@ public:
 
     const String getName() const override { return PLUGIN_IDs::bitCrushing.toString(); }
 
-    void parameterChanged(const String& parameterID, float newValue) override
-    {
-        if (parameterID == PARAMETER_IDs::bitCrushingDepth)
-            nBitsSize = 1 << nBits[(int) newValue];
-        else if (parameterID == PARAMETER_IDs::bitCrushingDitherNoise)
-            ditherNoise.setTargetValue(Decibels::decibelsToGain(newValue, -100.0f));
-    }
-
     ValueTree getParametersValueTree() override
     {
         return parameters.copyState();
@@ -82,33 +73,43 @@ public:
     void updateParameters(ValueTree& valueTree) override
     {
         parameters.replaceState(valueTree);
-        parametersUpdated = true;
     }
 
+    HeldParameterValue* findHeldValue(const String& parameterID) override { return snapshot.findHeldValue(parameterID); }
+
 private:
-    using FilterCoefs = dsp::IIR::Coefficients<float>;
+    enum Parameter
+    {
+        depth,
+        dither,
+        numParameters
+    };
 
-    float bitReduction(float in)
+    void readParameters()
     {
-        in = 0.5f * in + 0.5f;
-        in = nBitsSize * in;
-        in = std::round(in);
+        snapshot.update([this](size_t index, float newValue) { parameterChanged(index, newValue); });
+    }
 
-        return 2.0f * in / nBitsSize - 1.0f;
+    void parameterChanged(size_t index, float newValue)
+    {
+        switch (index)
+        {
+            case depth:
+                quantizer.setBitDepth(nBits[(int) newValue]);
+                break;
+            case dither:
+                quantizer.setDitherGain(Decibels::decibelsToGain(newValue, -100.0f));
+                break;
+            default:
+                break;
+        }
     }
 
     AudioProcessorValueTreeState parameters;
-
-    LinearSmoothedValue<float> ditherNoise;
+    ParameterSnapshot<numParameters> snapshot;
+    int64 silentInputSamples = 0;
 
     static constexpr int nBits[3] { 8, 10, 12 };
-    int nBitsSize = 1 << nBits[1];
-
-    Array<float> coefficients;
-
-    std::array<float, 2> lastErrorOut;
-    std::array<float, 2> errorDelay1;
-    std::array<float, 2> errorDelay2;
 
-    Random random;
+    NoiseShapedQuantizer quantizer;
 };
@@ -1,6 +1,7 @@
+#include "../DSP/LinkedCompressor.h"
 #include "ProcessorBase.h"
 
-class CompressorProcessor : public ProcessorBase, public AudioProcessorValueTreeState::Listener
+class CompressorProcessor final : public ProcessorBase
 {
 public:
     CompressorProcessor()
@@ -12,54 +13,60 @@ public:
                        std::make_unique<AudioParameterFloat>(PARAMETER_IDs::compressorAttack, "Compressor Attack", NormalisableRange<float>(0.01f, 1000.0f, 0.0f, 0.25f), 1.0f, "ms"),
                        std::make_unique<AudioParameterFloat>(PARAMETER_IDs::compressorRelease, "Compressor Release", NormalisableRange<float>(10.0f, 10000.0f, 0.0f, 0.25f), 100.0f, "ms") })
     {
-        parameters.addParameterListener(PARAMETER_IDs::compressorThreshold, this);
-        parameters.addParameterListener(PARAMETER_IDs::compressorRatio, this);
-        parameters.addParameterListener(PARAMETER_IDs::compressorAttack, this);
-        parameters.addParameterListener(PARAMETER_IDs::compressorRelease, this);
-
-        parameterChanged(PARAMETER_IDs::compressorThreshold, *parameters.getRawParameterValue(PARAMETER_IDs::compressorThreshold));
-        parameterChanged(PARAMETER_IDs::compressorRatio, *parameters.getRawParameterValue(PARAMETER_IDs::compressorRatio));
-        parameterChanged(PARAMETER_IDs::compressorAttack, *parameters.getRawParameterValue(PARAMETER_IDs::compressorAttack));
-        parameterChanged(PARAMETER_IDs::compressorRelease, *parameters.getRawParameterValue(PARAMETER_IDs::compressorRelease));
+        snapshot.attach(parameters,
+                        { PARAMETER_IDs::compressorThreshold,
+                          PARAMETER_IDs::compressorRatio,
+                          PARAMETER_IDs::compressorAttack,
+                          PARAMETER_IDs::compressorRelease });
+
+        readParameters();
     }
 
     void prepareToPlay(double sampleRate, int samplesPerBlock) override
     {
-        dsp::ProcessSpec spec { sampleRate, static_cast<uint32>(samplesPerBlock), 2 };
+        auto spec = getProcessSpec(sampleRate, samplesPerBlock);
 
         compressor.prepare(spec);
+        prepareScratch((int) spec.numChannels, samplesPerBlock);
+
+        snapshot.invalidate();
+        readParameters();
     }
 
     void processBlock(AudioBuffer<float>& buffer, MidiBuffer&) override
     {
+        readParameters();
+
         dsp::AudioBlock<float> block(buffer);
         dsp::ProcessContextReplacing<float> context(block);
 
-        compressor.process(context);
+        compressor.process(context, getScratchArena());
+        gainReduction.store(compressor.getGainReductionDecibels(), std::memory_order_relaxed);
     }
 
     void reset() override
     {
         compressor.reset();
+        gainReduction.store(0.0f, std::memory_order_relaxed);
+    }
+
+    size_t getScratchSize(int, int maximumBlockSize) const override
+    {
+        return LinkedCompressor::getScratchSize(maximumBlockSize);
     }
 
+    // The most gain reduction in the last block, in dB; safe to poll from the editor.
+    float getGainReductionDecibels() const noexcept { return gainReduction.load(std::memory_order_relaxed); }
+
+    float getMeterValue() const noexcept override { return getGainReductionDecibels(); }
+
+    bool isSmoothing() const noexcept override { return compressor.isSmoothing(); }
+
     AudioProcessorEditor* createEditor() override { return new GenericAudioProcessorEditor(*this); }
     bool hasEditor() const override { return true; }
 
     const String getName() const override { return PLUGIN_IDs::compressor.toString(); }
 
-    void parameterChanged(const String& parameterID, float newValue) override
-    {
-        if (parameterID == PARAMETER_IDs::compressorThreshold)
-            compressor.setThreshold(newValue);
-        else if (parameterID == PARAMETER_IDs::compressorRatio)
-            compressor.setRatio(newValue);
-        else if (parameterID == PARAMETER_IDs::compressorAttack)
-            compressor.setAttack(newValue);
-        else if (parameterID == PARAMETER_IDs::compressorRelease)
-            compressor.setRelease(newValue);
-    }
-
     ValueTree getParametersValueTree() override
     {
         return parameters.copyState();
@@ -68,11 +75,49 @@ public:
     void updateParameters(ValueTree& valueTree) override
     {
         parameters.replaceState(valueTree);
-        parametersUpdated = true;
     }
 
+    HeldParameterValue* findHeldValue(const String& parameterID) override { return snapshot.findHeldValue(parameterID); }
+
 private:
+    enum Parameter
+    {
+        threshold,
+        ratio,
+        attack,
+        release,
+        numParameters
+    };
+
+    void readParameters()
+    {
+        snapshot.update([this](size_t index, float newValue) { parameterChanged(index, newValue); });
+    }
+
+    void parameterChanged(size_t index, float newValue)
+    {
+        switch (index)
+        {
+            case threshold:
+                compressor.setThreshold(newValue);
+                break;
+            case ratio:
+                compressor.setRatio(newValue);
+                break;
+            case attack:
+                compressor.setAttack(newValue);
+                break;
+            case release:
+                compressor.setRelease(newValue);
+                break;
+            default:
+                break;
+        }
+    }
+
     AudioProcessorValueTreeState parameters;
+    ParameterSnapshot<numParameters> snapshot;
 
-    dsp::Compressor<float> compressor;
+    LinkedCompressor compressor;
+    std::atomic<float> gainReduction { 0.0f };
 };
@@ -1,6 +1,11 @@
+#include "../DSP/EchoDelayLine.h"
 #include "ProcessorBase.h"
 
-class EchoProcessor : public ProcessorBase, public AudioProcessorValueTreeState::Listener
+#ifndef AMORPHETUDE_ECHO_COMPACT_STORAGE
+#define AMORPHETUDE_ECHO_COMPACT_STORAGE 0
+#endif
+
+class EchoProcessor final : public ProcessorBase
 {
 public:
     EchoProcessor()
@@ -13,68 +18,73 @@ public:
                        std::make_unique<AudioParameterFloat>(PARAMETER_IDs::echoFeedback, "Echo Feedback", NormalisableRange<float>(-100.0f, 0.0f), -100.0f, "dB"),
                        std::make_unique<AudioParameterFloat>(PARAMETER_IDs::echoMix, "Echo Mix", NormalisableRange<float>(0.0f, 100.0f), 50.0f, "%") })
     {
-        parameters.addParameterListener(PARAMETER_IDs::echoRatio, this);
-        parameters.addParameterListener(PARAMETER_IDs::echoSmooth, this);
-        parameters.addParameterListener(PARAMETER_IDs::echoFeedback, this);
-        parameters.addParameterListener(PARAMETER_IDs::echoMix, this);
-
         smoothFilter.setType(dsp::FirstOrderTPTFilterType::lowpass);
 
-        parameterChanged(PARAMETER_IDs::echoRatio, *parameters.getRawParameterValue(PARAMETER_IDs::echoRatio));
-        parameterChanged(PARAMETER_IDs::echoSmooth, *parameters.getRawParameterValue(PARAMETER_IDs::echoSmooth));
-        parameterChanged(PARAMETER_IDs::echoFeedback, *parameters.getRawParameterValue(PARAMETER_IDs::echoFeedback));
-        parameterChanged(PARAMETER_IDs::echoMix, *parameters.getRawParameterValue(PARAMETER_IDs::echoMix));
+        tempoValue = parameters.getRawParameterValue(PARAMETER_IDs::echoTempo);
+        ratioValue = parameters.getRawParameterValue(PARAMETER_IDs::echoRatio);
+        feedbackValue = parameters.getRawParameterValue(PARAMETER_IDs::echoFeedback);
+
+        snapshot.attach(parameters,
+                        { PARAMETER_IDs::echoTempo,
+                          PARAMETER_IDs::echoRatio,
+                          PARAMETER_IDs::echoSmooth,
+                          PARAMETER_IDs::echoFeedback,
+                          PARAMETER_IDs::echoMix });
+
+        readParameters();
     }
 
     void prepareToPlay(double sampleRate, int samplesPerBlock) override
     {
-        dsp::ProcessSpec spec { sampleRate, static_cast<uint32>(samplesPerBlock), 2 };
+        auto spec = getProcessSpec(sampleRate, samplesPerBlock);
+
+        // long enough for the slowest tempo at the longest ratio, sized once for this sample rate
+        auto longestDelay = 60.0 / parameters.getParameterRange(PARAMETER_IDs::echoTempo).start * echoRatios[0] * sampleRate;
 
-        prepareAll(spec, lagrange, smoothFilter, mixer);
+        delayLine.prepare(spec, (int) std::ceil(longestDelay) + 1);
+        prepareAll(spec, smoothFilter);
+        prepareScratch((int) spec.numChannels, samplesPerBlock);
 
-        feedback.reset(spec.sampleRate, 0.05);
+        snapshot.invalidate();
+        readParameters();
     }
 
     void processBlock(AudioBuffer<float>& buffer, MidiBuffer&) override
     {
-        dsp::AudioBlock<float> block(buffer);
-        dsp::ProcessContextReplacing<float> context(block);
-
-        const auto& inputBlock = context.getInputBlock();
-        const auto& outputBlock = context.getOutputBlock();
-        const auto numSamples = inputBlock.getNumSamples();
-        const auto numChannels = inputBlock.getNumChannels();
+        readParameters();
 
-        mixer.pushDrySamples(inputBlock);
+        dsp::AudioBlock<float> block(buffer);
 
-        delayLineValue = 60.0 / *parameters.getRawParameterValue(PARAMETER_IDs::echoTempo) * getSampleRate() * echoRatio;
-        float smoothDelayLineValue = smoothFilter.processSample(0, delayLineValue);
+        delayLineValue = 60.0 / snapshot[tempo] * getSampleRate() * echoRatio;
+        delayLine.setDelay((float) smoothFilter.processSample(0, delayLineValue));
+        delayLine.process(dsp::ProcessContextReplacing<float>(block), getScratchArena());
+    }
 
-        for (size_t channel = 0; channel < numChannels; ++channel)
-        {
-            auto* inputSamples = inputBlock.getChannelPointer(channel);
-            auto* outputSamples = outputBlock.getChannelPointer(channel);
+    void reset() override
+    {
+        resetAll(delayLine, smoothFilter);
+    }
 
-            for (size_t i = 0; i < numSamples; ++i)
-            {
-                auto output = inputSamples[i] - feedback.getNextValue() * lastOutput[channel];
+    // Until the feedback has brought the last echo below the silence threshold.
+    int getTailSamples() const override
+    {
+        const auto feedback = (double) Decibels::decibelsToGain(feedbackValue->load(), -100.0f);
 
-                outputSamples[i] = output;
+        if (feedback >= 1.0)
+            return infiniteTail;
 
-                lagrange.pushSample((int) channel, output);
-                lagrange.setDelay(smoothDelayLineValue);
-                lastOutput[channel] = lagrange.popSample((int) channel);
-            }
-        }
+        const auto delay = 60.0 / tempoValue->load() * getSampleRate() * echoRatios[jlimit(0, 3, (int) ratioValue->load())];
+        const auto numRepeats = feedback > 0.0 ? std::ceil(std::log((double) silenceThreshold) / std::log(feedback)) : 0.0;
+        const auto tail = std::ceil(delay * (numRepeats + 1.0));
 
-        mixer.mixWetSamples(outputBlock);
+        return tail < (double) std::numeric_limits<int>::max() ? (int) tail : infiniteTail;
     }
 
-    void reset() override
-    {
-        resetAll(lagrange, smoothFilter, mixer);
+    bool isSmoothing() const noexcept override { return delayLine.isSmoothing(); }
 
-        std::fill(lastOutput.begin(), lastOutput.end(), 0.0f);
+    size_t getScratchSize(int, int maximumBlockSize) const override
+    {
+        return decltype(delayLine)::getScratchSize(maximumBlockSize);
     }
 
     AudioProcessorEditor* createEditor() override { return new GenericAudioProcessorEditor(*this); }
@@ -82,18 +92,6 @@ public:
 
     const String getName() const override { return PLUGIN_IDs::echo.toString(); }
 
-    void parameterChanged(const String& parameterID, float newValue) override
-    {
-        if (parameterID == PARAMETER_IDs::echoRatio)
-            echoRatio = echoRatios[(int) newValue];
-        else if (parameterID == PARAMETER_IDs::echoSmooth)
-            smoothFilter.setCutoffFrequency(1000.0 / newValue);
-        else if (parameterID == PARAMETER_IDs::echoFeedback)
-            feedback.setTargetValue(Decibels::decibelsToGain(newValue, -100.0f));
-        else if (parameterID == PARAMETER_IDs::echoMix)
-            mixer.setWetMixProportion(newValue / 100.0f);
-    }
-
     ValueTree getParametersValueTree() override
     {
         return parameters.copyState();
@@ -102,14 +100,58 @@ public:
     void updateParameters(ValueTree& valueTree) override
     {
         parameters.replaceState(valueTree);
-        parametersUpdated = true;
     }
 
+    HeldParameterValue* findHeldValue(const String& parameterID) override { return snapshot.findHeldValue(parameterID); }
+
 private:
+    enum Parameter
+    {
+        tempo,
+        ratio,
+        smooth,
+        feedbackGain,
+        mix,
+        numParameters
+    };
+
+    void readParameters()
+    {
+        snapshot.update([this](size_t index, float newValue) { parameterChanged(index, newValue); });
+    }
+
+    void parameterChanged(size_t index, float newValue)
+    {
+        switch (index)
+        {
+            case ratio:
+                echoRatio = echoRatios[(int) newValue];
+                break;
+            case smooth:
+                smoothFilter.setCutoffFrequency(1000.0 / newValue);
+                break;
+            case feedbackGain:
+                delayLine.setFeedback(Decibels::decibelsToGain(newValue, -100.0f));
+                break;
+            case mix:
+                delayLine.setWetMixProportion(newValue / 100.0f);
+                break;
+            default:
+                break;
+        }
+    }
+
     AudioProcessorValueTreeState parameters;
+    ParameterSnapshot<numParameters> snapshot;
+    std::atomic<float>* tempoValue = nullptr;
+    std::atomic<float>* ratioValue = nullptr;
+    std::atomic<float>* feedbackValue = nullptr;
 
-    static constexpr auto delaySamples = 192000;
-    dsp::DelayLine<float, dsp::DelayLineInterpolationTypes::Lagrange3rd> lagrange { delaySamples };
+#if AMORPHETUDE_ECHO_COMPACT_STORAGE
+    EchoDelayLine<HalfFloatDelayStorage> delayLine;
+#else
+    EchoDelayLine<FloatDelayStorage> delayLine;
+#endif
 
     double delayLineValue;
     dsp::FirstOrderTPTFilter<double> smoothFilter;
@@ -119,9 +161,4 @@ private:
                                             1.0 / 3.0,
                                             1.0 / 4.0 };
     double echoRatio;
-
-    LinearSmoothedValue<float> feedback;
-    dsp::DryWetMixer<float> mixer;
-
-    std::array<float, 2> lastOutput;
 };
@@ -1,6 +1,9 @@
+#include "../DSP/AntiderivativeWaveShaper.h"
+#include "../DSP/BlockSmoother.h"
+#include "../DSP/LatencyDelay.h"
 #include "ProcessorBase.h"
 
-class OverdriveProcessor : public ProcessorBase, public AudioProcessorValueTreeState::Listener
+class OverdriveProcessor final : public ProcessorBase
 {
 public:
     OverdriveProcessor()
@@ -9,59 +12,161 @@ public:
                      PLUGIN_IDs::overdrive,
                      { std::make_unique<AudioParameterFloat>(PARAMETER_IDs::overdriveTone, "Overdrive Tone", NormalisableRange<float>(-40.0f, 40.0f), 0.0f, "dB"),
                        std::make_unique<AudioParameterFloat>(PARAMETER_IDs::overdriveGain, "Overdrive Gain", NormalisableRange<float>(-40.0f, 40.0f), 0.0f, "dB"),
-                       std::make_unique<AudioParameterFloat>(PARAMETER_IDs::overdriveMixer, "Overdrive Mix", NormalisableRange<float>(0.0f, 100.0f), 100.0f, "%") })
+                       std::make_unique<AudioParameterFloat>(PARAMETER_IDs::overdriveMixer, "Overdrive Mix", NormalisableRange<float>(0.0f, 100.0f), 100.0f, "%"),
+                       std::make_unique<AudioParameterChoice>(PARAMETER_IDs::overdriveOversampling, "Overdrive Oversampling", StringArray { "1x", "2x", "4x", "8x" }, 1),
+                       std::make_unique<AudioParameterChoice>(PARAMETER_IDs::overdriveOversamplingFilter, "Overdrive Oversampling Filter", StringArray { "IIR", "FIR" }, 0) })
     {
-        waveShaper.functionToUse = [](float x) {
-            return std::sin(x);
-        };
+        createOversamplers(2);
 
-        parameters.addParameterListener(PARAMETER_IDs::overdriveTone, this);
-        parameters.addParameterListener(PARAMETER_IDs::overdriveGain, this);
-        parameters.addParameterListener(PARAMETER_IDs::overdriveMixer, this);
+        // the gains glide like the mix, so a preset switch does not click
+        for (auto& path : wetPaths)
+            path.tone.setRampDurationSeconds(0.05);
 
-        parameterChanged(PARAMETER_IDs::overdriveTone, *parameters.getRawParameterValue(PARAMETER_IDs::overdriveTone));
-        parameterChanged(PARAMETER_IDs::overdriveGain, *parameters.getRawParameterValue(PARAMETER_IDs::overdriveGain));
-        parameterChanged(PARAMETER_IDs::overdriveMixer, *parameters.getRawParameterValue(PARAMETER_IDs::overdriveMixer));
+        gain.setRampDurationSeconds(0.05);
+
+        snapshot.attach(parameters,
+                        { PARAMETER_IDs::overdriveTone,
+                          PARAMETER_IDs::overdriveGain,
+                          PARAMETER_IDs::overdriveMixer,
+                          PARAMETER_IDs::overdriveOversampling,
+                          PARAMETER_IDs::overdriveOversamplingFilter });
+
+        readParameters();
     }
 
     void prepareToPlay(double sampleRate, int samplesPerBlock) override
     {
-        dsp::ProcessSpec spec { sampleRate, static_cast<uint32>(samplesPerBlock), 2 };
+        auto spec = getProcessSpec(sampleRate, samplesPerBlock);
+
+        if (spec.numChannels != numOversampledChannels)
+            createOversamplers(spec.numChannels);
+
+        // every tier is ready to go, so switching between them never allocates
+        maximumLatency = 0;
+
+        for (auto& oversampler : oversamplers)
+        {
+            oversampler->initProcessing(spec.maximumBlockSize);
+            maximumLatency = jmax(maximumLatency, roundToInt(oversampler->getLatencyInSamples()));
+        }
+
+        // the tone is a plain gain, so it is applied to the oversampled signal and leaves the
+        // input in the buffer untouched for the dry path; it is prepared for its tier's rate when a
+        // path takes a tier
+        const auto maximumFactor = (uint32) 1 << (numFactors - 1);
+        dsp::ProcessSpec oversampledSpec { sampleRate * (double) maximumFactor, spec.maximumBlockSize * maximumFactor, spec.numChannels };
+
+        for (auto& path : wetPaths)
+            path.waveShaper.prepare(oversampledSpec);
+
+        baseSpec = spec;
+
+        gain.prepare(spec);
+        dryDelay.prepare(spec, maximumLatency);
+        wetMix.reset(sampleRate, 0.05);
+        tierMix.reset(sampleRate, 0.02);
+        prepareScratch((int) spec.numChannels, samplesPerBlock);
+
+        snapshot.invalidate();
+        readParameters();
 
-        oversampling.initProcessing(spec.maximumBlockSize);
+        for (auto& path : wetPaths)
+            path.oversampling = nullptr;
 
-        prepareAll(spec, tone, gain, mixer);
+        selectOversampler(false);
+    }
+
+    // A new oversampling tier takes over here, before the chain reads the slot's latency.
+    void prepareBlock() override
+    {
+        readParameters();
+        selectOversampler(true);
     }
 
     void processBlock(AudioBuffer<float>& buffer, MidiBuffer&) override
     {
+        readParameters();
+        selectOversampler(true);
+
         dsp::AudioBlock<float> block(buffer);
-        dsp::ProcessContextReplacing<float> context(block);
+        auto& active = wetPaths[activePath];
+
+        auto& arena = getScratchArena();
+        ScratchArena::Scope scope(arena);
 
-        const auto& inputBlock = context.getInputBlock();
+        const auto isSwitchingTier = tierMix.isSmoothing();
+        const auto wetGains = wetMix.getRamp(arena, buffer.getNumSamples());
 
-        mixer.setWetLatency(oversampling.getLatencyInSamples());
-        mixer.pushDrySamples(inputBlock);
+        auto wetBlock = ! isSwitchingTier && wetGains.isConstant() && wetGains.value >= 1.0f
+                            ? dsp::AudioBlock<float>()
+                            : arena.allocateBlock(block.getNumChannels(), block.getNumSamples());
 
-        tone.process(context);
+        // fully wet needs no scratch, and is where the slot ends up without room for it
+        if (wetBlock.getNumChannels() == 0)
+        {
+            tierMix.setCurrentAndTargetValue(1.0f);
+            dryDelay.push(block);
 
-        auto oversamplingBlock = oversampling.processSamplesUp(inputBlock);
+            active.process(block, block);
+            gain.process(dsp::ProcessContextReplacing<float>(block));
+            return;
+        }
 
-        dsp::ProcessContextReplacing<float> waveshaperContext(oversamplingBlock);
+        active.process(block, wetBlock);
 
-        waveShaper.process(waveshaperContext);
+        auto fadingWet = isSwitchingTier ? arena.allocateBlock(block.getNumChannels(), block.getNumSamples()) : dsp::AudioBlock<float>();
+        auto fadingDry = isSwitchingTier ? arena.allocateBlock(block.getNumChannels(), block.getNumSamples()) : dsp::AudioBlock<float>();
 
-        auto& outputBlock = context.getOutputBlock();
-        oversampling.processSamplesDown(outputBlock);
+        if (fadingWet.getNumChannels() > 0 && fadingDry.getNumChannels() > 0)
+        {
+            // the old tier's wet path and the dry signal at its latency fade out together
+            const auto tierGains = tierMix.getRamp(arena, buffer.getNumSamples());
 
-        gain.process(context);
+            wetPaths[1 - activePath].process(block, fadingWet);
+            crossfade(fadingWet, wetBlock, tierGains);
 
-        mixer.mixWetSamples(outputBlock);
+            dryDelay.read(block, fadingDry, fadingLatency);
+            dryDelay.process(dsp::ProcessContextReplacing<float>(block));
+            crossfade(fadingDry, block, tierGains);
+        }
+        else
+        {
+            // without room to fade, the switch to the new tier is instant
+            tierMix.setCurrentAndTargetValue(1.0f);
+            dryDelay.process(dsp::ProcessContextReplacing<float>(block));
+        }
+
+        gain.process(dsp::ProcessContextReplacing<float>(wetBlock));
+        mixWetSamples(block, wetBlock, wetGains);
     }
 
     void reset() override
     {
-        resetAll(tone, gain, mixer, oversampling);
+        resetAll(gain, dryDelay);
+
+        for (auto& path : wetPaths)
+            resetAll(path.tone, path.waveShaper);
+
+        for (auto& oversampler : oversamplers)
+            oversampler->reset();
+
+        wetMix.setCurrentAndTargetValue(wetMix.getTargetValue());
+        tierMix.setCurrentAndTargetValue(1.0f);
+    }
+
+    int getMaximumSlotLatency() const override { return maximumLatency; }
+
+    bool isSmoothing() const noexcept override
+    {
+        return wetMix.isSmoothing() || tierMix.isSmoothing() || gain.isSmoothing() || wetPaths[activePath].tone.isSmoothing();
+    }
+
+    // The wet block and the mix ramp, and while switching tiers the old tier's wet and dry blocks
+    // and the tier ramp.
+    size_t getScratchSize(int numChannels, int maximumBlockSize) const override
+    {
+        return 3 * ScratchArena::getBlockSize((size_t) numChannels, (size_t) maximumBlockSize)
+               + 2 * ScratchArena::getPaddedSize((size_t) maximumBlockSize);
     }
 
     AudioProcessorEditor* createEditor() override { return new GenericAudioProcessorEditor(*this); }
@@ -69,16 +174,6 @@ public:
 
     const String getName() const override { return PLUGIN_IDs::overdrive.toString(); }
 
-    void parameterChanged(const String& parameterID, float newValue) override
-    {
-        if (parameterID == PARAMETER_IDs::overdriveTone)
-            tone.setGainDecibels(newValue);
-        else if (parameterID == PARAMETER_IDs::overdriveGain)
-            gain.setGainDecibels(newValue);
-        else if (parameterID == PARAMETER_IDs::overdriveMixer)
-            mixer.setWetMixProportion(newValue / 100.0f);
-    }
-
     ValueTree getParametersValueTree() override
     {
         return parameters.copyState();
@@ -87,14 +182,201 @@ public:
     void updateParameters(ValueTree& valueTree) override
     {
         parameters.replaceState(valueTree);
-        parametersUpdated = true;
     }
 
+    HeldParameterValue* findHeldValue(const String& parameterID) override { return snapshot.findHeldValue(parameterID); }
+
 private:
+    enum Parameter
+    {
+        toneGain,
+        outputGain,
+        mix,
+        oversamplingFactor,
+        oversamplingFilter,
+        numParameters
+    };
+
+    // The oversampling tiers: 1x to 8x, each with either filter type, in parameter choice order.
+    static constexpr size_t numFactors = 4;
+
+    enum Filter
+    {
+        iir,
+        fir,
+        numFilters
+    };
+
+    // Offline renders run at least 4x with linear phase filters.
+    static constexpr size_t offlineFactorIndex = 2;
+
+    void readParameters()
+    {
+        snapshot.update([this](size_t index, float newValue) { parameterChanged(index, newValue); });
+    }
+
+    void parameterChanged(size_t index, float newValue)
+    {
+        switch (index)
+        {
+            case toneGain:
+                for (auto& path : wetPaths)
+                    path.tone.setGainDecibels(newValue);
+                break;
+            case outputGain:
+                gain.setGainDecibels(newValue);
+                break;
+            case mix:
+                wetMix.setTargetValue(newValue / 100.0f);
+                break;
+            case oversamplingFactor:
+                selectedFactorIndex = (size_t) jlimit(0, (int) numFactors - 1, roundToInt(newValue));
+                break;
+            case oversamplingFilter:
+                selectedFilter = (size_t) jlimit(0, (int) numFilters - 1, roundToInt(newValue));
+                break;
+            default:
+                break;
+        }
+    }
+
+    // The oversamplers filter every channel they are made for, so they are made for just as many as
+    // the slot processes.
+    void createOversamplers(uint32 numChannels)
+    {
+        for (auto& path : wetPaths)
+            path.oversampling = nullptr;
+
+        numOversampledChannels = numChannels;
+
+        for (size_t factorIndex = 0; factorIndex < numFactors; ++factorIndex)
+        {
+            oversamplers[factorIndex * numFilters + iir] = std::make_unique<dsp::Oversampling<float>>(numChannels, factorIndex, dsp::Oversampling<float>::filterHalfBandPolyphaseIIR, true, true);
+            oversamplers[factorIndex * numFilters + fir] = std::make_unique<dsp::Oversampling<float>>(numChannels, factorIndex, dsp::Oversampling<float>::filterHalfBandFIREquiripple, true, true);
+        }
+    }
+
+    // Switches to the oversampler of the selected tier, crossfading from the old one over 20 ms. The
+    // new one starts from silence; the dry delay keeps its history and crossfades from the old
+    // tier's latency to the new one's along with the wet paths.
+    void selectOversampler(bool shouldCrossfade)
+    {
+        auto factorIndex = selectedFactorIndex;
+        auto filter = selectedFilter;
+
+        if (isNonRealtime())
+        {
+            factorIndex = jmax(factorIndex, offlineFactorIndex);
+            filter = fir;
+        }
+
+        auto* selected = oversamplers[factorIndex * numFilters + filter].get();
+
+        if (selected == wetPaths[activePath].oversampling)
+            return;
+
+        if (shouldCrossfade && wetPaths[activePath].oversampling != nullptr)
+        {
+            fadingLatency = dryDelay.getLatencyInSamples();
+            activePath = 1 - activePath;
+            tierMix.setCurrentAndTargetValue(0.0f);
+            tierMix.setTargetValue(1.0f);
+        }
+
+        auto& active = wetPaths[activePath];
+        active.oversampling = selected;
+        resetAll(*active.oversampling, active.waveShaper);
+
+        // so the tone's ramp takes as long at every tier
+        const auto factor = (uint32) selected->getOversamplingFactor();
+        active.tone.prepare({ baseSpec.sampleRate * (double) factor, baseSpec.maximumBlockSize * factor, baseSpec.numChannels });
+
+        const auto latency = roundToInt(selected->getLatencyInSamples());
+        dryDelay.setLatency(latency);
+        setSlotLatency(latency);
+    }
+
+    // Fades from the old tier's wet signal into the new one's, in place.
+    static void crossfade(const dsp::AudioBlock<float>& fadingBlock, const dsp::AudioBlock<float>& wetBlock, const BlockSmoother::Ramp& gains)
+    {
+        const auto numSamples = (int) wetBlock.getNumSamples();
+
+        for (size_t channel = 0; channel < wetBlock.getNumChannels(); ++channel)
+        {
+            auto* samples = wetBlock.getChannelPointer(channel);
+            auto* fadingSamples = fadingBlock.getChannelPointer(channel);
+
+            for (int i = 0; i < numSamples; ++i)
+                samples[i] = fadingSamples[i] + gains[i] * (samples[i] - fadingSamples[i]);
+        }
+    }
+
+    // Linear dry/wet rule, mixed into the delayed dry signal already in the block.
+    static void mixWetSamples(const dsp::AudioBlock<float>& block, const dsp::AudioBlock<float>& wetBlock, const BlockSmoother::Ramp& wetGains)
+    {
+        const auto numSamples = (int) block.getNumSamples();
+
+        if (wetGains.isConstant())
+        {
+            const auto wet = wetGains.value;
+
+            for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+            {
+                FloatVectorOperations::multiply(block.getChannelPointer(channel), 1.0f - wet, numSamples);
+                FloatVectorOperations::addWithMultiply(block.getChannelPointer(channel), wetBlock.getChannelPointer(channel), wet, numSamples);
+            }
+
+            return;
+        }
+
+        for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+        {
+            auto* samples = block.getChannelPointer(channel);
+            auto* wetSamples = wetBlock.getChannelPointer(channel);
+
+            for (int i = 0; i < numSamples; ++i)
+                samples[i] += wetGains.values[i] * (wetSamples[i] - samples[i]);
+        }
+    }
+
     AudioProcessorValueTreeState parameters;
+    ParameterSnapshot<numParameters> snapshot;
+
+    // The tone and the shaper at the oversampled rate. The shaper's half sample of delay there is
+    // left out of the dry delay.
+    struct WetPath
+    {
+        // Writes the wet signal for the input to the output, which may be the input.
+        void process(const dsp::AudioBlock<float>& input, dsp::AudioBlock<float>& output)
+        {
+            auto oversampledBlock = oversampling->processSamplesUp(input);
+            dsp::ProcessContextReplacing<float> context(oversampledBlock);
+
+            tone.process(context);
+            waveShaper.process(context);
+
+            oversampling->processSamplesDown(output);
+        }
+
+        dsp::Oversampling<float>* oversampling = nullptr;
+        dsp::Gain<float> tone;
+        AntiderivativeWaveShaper<SineCurve> waveShaper;
+    };
+
+    dsp::ProcessSpec baseSpec {};
+    dsp::Gain<float> gain;
+    LatencyDelay dryDelay;
+    BlockSmoother wetMix;
+    std::array<std::unique_ptr<dsp::Oversampling<float>>, numFactors * numFilters> oversamplers;
+    uint32 numOversampledChannels = 0;
+    int maximumLatency = 0;
+    // the anti-aliased sine gets by with 2x, the default
+    size_t selectedFactorIndex = 1;
+    size_t selectedFilter = iir;
 
-    dsp::Gain<float> tone, gain;
-    dsp::DryWetMixer<float> mixer { 10 };
-    dsp::Oversampling<float> oversampling { 2, 2, dsp::Oversampling<float>::filterHalfBandPolyphaseIIR, true, false };
-    dsp::WaveShaper<float> waveShaper;
+    // the new tier's path and, while tierMix fades it in, the old one's
+    std::array<WetPath, 2> wetPaths;
+    size_t activePath = 0;
+    BlockSmoother tierMix { 1.0f };
+    int fadingLatency = 0;
 };
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// A parameter's value as its processor reads it: the host's, unless the audio thread has held it at
+// another one, e.g. for a preset the host has not been told about yet. A held value lasts until the
+// parameter itself changes, which is what telling the host does.
+class HeldParameterValue
+{
+public:
+    void attach(std::atomic<float>* sourceToRead) noexcept { source = sourceToRead; }
+
+    // audio thread
+    void hold(float value) noexcept
+    {
+        const auto sourceValue = source->load(std::memory_order_relaxed);
+
+        if (value == sourceValue)
+        {
+            release();
+            return;
+        }
+
+        sourceWhenHeld.store(sourceValue, std::memory_order_relaxed);
+        heldValue.store(value, std::memory_order_relaxed);
+        isHeld.store(true, std::memory_order_release);
+    }
+
+    // audio thread
+    void release() noexcept { isHeld.store(false, std::memory_order_relaxed); }
+
+    float read() noexcept
+    {
+        const auto sourceValue = source->load(std::memory_order_relaxed);
+
+        if (! isHeld.load(std::memory_order_acquire))
+            return sourceValue;
+
+        if (sourceValue == sourceWhenHeld.load(std::memory_order_relaxed))
+            return heldValue.load(std::memory_order_relaxed);
+
+        release();
+        return sourceValue;
+    }
+
+private:
+    std::atomic<float>* source = nullptr;
+    std::atomic<float> heldValue { 0.0f };
+    std::atomic<float> sourceWhenHeld { 0.0f };
+    std::atomic<bool> isHeld { false };
+};
+
+// A per-block copy of a processor's parameters.
+//
+// Hosts write parameter values from whatever thread they like. update() reads each value once, at the
+// start of a block on the audio thread, so the whole block works from one consistent set, and reports
+// the parameters that changed by their index rather than by comparing parameter ID strings.
+template <size_t NumParameters>
+class ParameterSnapshot
+{
+public:
+    void attach(AudioProcessorValueTreeState& state, const std::array<const char*, NumParameters>& parameterIDs)
+    {
+        ids = parameterIDs;
+
+        for (size_t i = 0; i < NumParameters; ++i)
+        {
+            auto* source = state.getRawParameterValue(parameterIDs[i]);
+            jassert(source != nullptr);
+
+            sources[i].attach(source);
+        }
+
+        invalidate();
+    }
+
+    // Makes the next update() report every parameter, e.g. after the DSP has been prepared again.
+    void invalidate() noexcept { needsFullUpdate = true; }
+
+    template <typename Callback>
+    void update(Callback&& parameterChanged)
+    {
+        for (size_t i = 0; i < NumParameters; ++i)
+        {
+            auto newValue = sources[i].read();
+
+            if (needsFullUpdate || newValue != values[i])
+            {
+                values[i] = newValue;
+                parameterChanged(i, newValue);
+            }
+        }
+
+        needsFullUpdate = false;
+    }
+
+    float operator[](size_t index) const noexcept { return values[index]; }
+
+    // The value update() reads for the parameter, or nullptr when the snapshot does not have it.
+    HeldParameterValue* findHeldValue(const String& parameterID) noexcept
+    {
+        for (size_t i = 0; i < NumParameters; ++i)
+            if (parameterID == ids[i])
+                return &sources[i];
+
+        return nullptr;
+    }
+
+private:
+    std::array<const char*, NumParameters> ids {};
+    std::array<HeldParameterValue, NumParameters> sources;
+    std::array<float, NumParameters> values {};
+    bool needsFullUpdate = true;
+};
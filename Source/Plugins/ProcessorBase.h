@@ -2,6 +2,12 @@
 
 #include <JuceHeader.h>
 
+#include "../DSP/BlockSmoother.h"
+#include "../DSP/LatencyDelay.h"
+#include "../Metering.h"
+#include "../ScratchArena.h"
+#include "ParameterSnapshot.h"
+
 namespace PLUGIN_IDs
 {
 #define DECLARE_ID(name) const Identifier name(#name);
@@ -23,6 +29,7 @@ namespace PARAMETER_IDs
 #define DECLARE_ID(str) constexpr const char* str { #str };
 
 DECLARE_ID(effectSelector)
+DECLARE_ID(preset)
 
 DECLARE_ID(compressorBypass)
 DECLARE_ID(compressorThreshold)
@@ -34,6 +41,8 @@ DECLARE_ID(overdriveBypass)
 DECLARE_ID(overdriveTone)
 DECLARE_ID(overdriveGain)
 DECLARE_ID(overdriveMixer)
+DECLARE_ID(overdriveOversampling)
+DECLARE_ID(overdriveOversamplingFilter)
 
 DECLARE_ID(autowahBypass)
 DECLARE_ID(autowahMode)
@@ -77,7 +86,25 @@ void resetAll(Processors&... processors)
 class ProcessorBase : public AudioProcessor
 {
 public:
-    ProcessorBase() {}
+    // Stereo until the chain configures the slot with setPlayConfigDetails().
+    ProcessorBase()
+        : AudioProcessor(BusesProperties()
+                             .withInput("Input", AudioChannelSet::stereo(), true)
+                             .withOutput("Output", AudioChannelSet::stereo(), true))
+    {
+    }
+
+    // Enough for 7.1.4 or third-order ambisonics.
+    static constexpr int maxNumChannels = 16;
+
+    // Any layout of up to maxNumChannels. The chain configures both sides alike, one at a time, so
+    // either may briefly differ from the other.
+    bool isBusesLayoutSupported(const BusesLayout& layouts) const override
+    {
+        auto isSupported = [](const AudioChannelSet& set) { return set.size() >= 1 && set.size() <= maxNumChannels; };
+
+        return isSupported(layouts.getMainInputChannelSet()) && isSupported(layouts.getMainOutputChannelSet());
+    }
 
     void prepareToPlay(double, int) override {}
     void releaseResources() override {}
@@ -89,7 +116,15 @@ public:
     const String getName() const override { return {}; }
     bool acceptsMidi() const override { return false; }
     bool producesMidi() const override { return false; }
-    double getTailLengthSeconds() const override { return 0; }
+    double getTailLengthSeconds() const override
+    {
+        const auto tail = getTailSamples();
+
+        if (tail == infiniteTail)
+            return std::numeric_limits<double>::infinity();
+
+        return getSampleRate() > 0.0 ? (tail + getSlotLatency()) / getSampleRate() : 0.0;
+    }
 
     int getNumPrograms() override { return 0; }
     int getCurrentProgram() override { return 0; }
@@ -102,11 +137,288 @@ public:
 
     virtual ValueTree getParametersValueTree() { return {}; }
     virtual void updateParameters(ValueTree&) {}
-    virtual bool isParametersUpdated() { return parametersUpdated; }
+
+    // What the slot's DSP reads for one of its parameters, so a preset can switch it without waiting
+    // for the host. nullptr for a parameter the slot reads some other way.
+    virtual HeldParameterValue* findHeldValue(const String& /*parameterID*/) { return nullptr; }
+
+    // How many samples of scratch memory the slot borrows while processing one block.
+    virtual size_t getScratchSize(int /*numChannels*/, int /*maximumBlockSize*/) const { return 0; }
+
+    // What processSlot() borrows on top of that while crossfading the bypass.
+    size_t getSlotScratchSize(int numChannels, int maximumBlockSize) const
+    {
+        return getScratchSize(numChannels, maximumBlockSize)
+               + ScratchArena::getBlockSize((size_t) numChannels, (size_t) maximumBlockSize)
+               + ScratchArena::getPaddedSize((size_t) maximumBlockSize);
+    }
+
+    // Lets the slot borrow from the arena of the chain it runs in. A slot running on its own
+    // uses an arena of its own instead.
+    void setScratchArena(ScratchArena* arenaToUse) { sharedArena = arenaToUse; }
+
+    // The slot's latency in samples. Unlike getLatencySamples(), the slot may change it from the
+    // audio thread; the chain adds it up and reports the total to the host.
+    int getSlotLatency() const noexcept { return slotLatency.load(std::memory_order_relaxed); }
+
+    // The most latency the slot can switch to while playing.
+    virtual int getMaximumSlotLatency() const { return getSlotLatency(); }
+
+    // Prepares the bypass crossfade, the delay that stands in for the slot's latency while it is
+    // bypassed, and the slot's meter. Call it after prepareToPlay().
+    void prepareBypass(int numChannels, int maximumBlockSize, bool isBypassed)
+    {
+        meter.prepare(getSampleRate());
+
+        bypassDelay.prepare({ getSampleRate(), (uint32) maximumBlockSize, (uint32) numChannels }, getMaximumSlotLatency());
+        bypassDelay.setLatency(getSlotLatency());
+
+        bypassMix.reset(getSampleRate(), 0.02);
+        bypassMix.setCurrentAndTargetValue(isBypassed ? 1.0f : 0.0f);
+        hasSkippedDSP = false;
+
+        preparedBlockSize = maximumBlockSize;
+    }
+
+    // Has processSlot() meter the slot's output.
+    void setMeteringEnabled(bool shouldMeter) noexcept { meteringEnabled.store(shouldMeter, std::memory_order_relaxed); }
+
+    // The slot's output level, see LevelMeter::pull(). message thread
+    bool pullMeterReading(MeterReading& reading) { return meter.pull(reading); }
+
+    // Has processSlot() start the slot over from silence, for a slot that comes back into a chain.
+    void requestReset() noexcept { resetPending.store(true, std::memory_order_release); }
+
+    static constexpr int infiniteTail = -1;
+
+    // Anything quieter than this, about -120 dB, counts as silence.
+    static constexpr float silenceThreshold = 1.0e-6f;
+
+    // How long the slot keeps sounding once its input falls silent, not counting its latency, or
+    // infiniteTail. Called from both threads, so it reads the raw parameter values.
+    virtual int getTailSamples() const { return 0; }
+
+    // What the slot's meter shows next to the levels. audio thread
+    virtual float getMeterValue() const noexcept { return 0.0f; }
+
+    // Whether any of the slot's own smoothed values is still gliding. audio thread
+    virtual bool isSmoothing() const noexcept { return false; }
+
+    // Whether nothing is left to finish: no bypass crossfade, no reset to do and no value gliding.
+    // A slot that is not settled keeps processing through silence. audio thread
+    bool isSettled() const noexcept
+    {
+        return ! bypassMix.isSmoothing() && ! resetPending.load(std::memory_order_relaxed) && ! isSmoothing();
+    }
+
+    // Called at the start of every processSlot(), before the slot's latency is read, so a slot that
+    // changes its latency does so in time for the bypass delay to follow. audio thread
+    virtual void prepareBlock() {}
+
+    static bool isSilent(const AudioBuffer<float>& buffer) noexcept
+    {
+        if (buffer.hasBeenCleared())
+            return true;
+
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+        {
+            auto range = FloatVectorOperations::findMinAndMax(buffer.getReadPointer(channel), buffer.getNumSamples());
+
+            if (range.getStart() < -silenceThreshold || range.getEnd() > silenceThreshold)
+                return false;
+        }
+
+        return true;
+    }
+
+    // Whether the slot is settled and nothing has gone in or come out for longer than the tail and
+    // the latency, so a silent block would come out silent too. A bypassed slot only has its latency
+    // to run out.
+    bool isIdle() const
+    {
+        if (! isSettled())
+            return false;
+
+        const auto tail = isFullyBypassed() ? 0 : getTailSamples();
+
+        return tail != infiniteTail && silentSamples > (int64) tail + getSlotLatency();
+    }
+
+    // What the chain does with a slot instead of processSlot() while the whole chain is idle: it picks
+    // up a change of bypass, which the next block starts crossfading, and meters the silent block.
+    void skipSlot(int numSamples, int numChannels, bool isBypassed = false)
+    {
+        bypassMix.setTargetValue(isBypassed ? 1.0f : 0.0f);
+
+        if (meteringEnabled.load(std::memory_order_relaxed))
+            meter.processSilence(numSamples, numChannels, getMeterValue());
+    }
+
+    // How the chain runs a slot: like processBlock(), except that
+    // - a silent block is passed through untouched while the slot is idle,
+    // - bypassing crossfades to the input over 20 ms, after which the slot's DSP no longer runs and
+    //   the input is only delayed by the slot's latency, so the chain's latency stays the same,
+    // - a block longer than the slot was prepared for is processed in parts.
+    // Returns whether the slot processed.
+    bool processSlot(AudioBuffer<float>& buffer, MidiBuffer& midiMessages, bool isBypassed = false)
+    {
+        // the slot's scratch and DSP only hold the block size it was prepared for
+        if (preparedBlockSize > 0 && buffer.getNumSamples() > preparedBlockSize)
+            return processSlotInParts(buffer, midiMessages, isBypassed);
+
+        if (resetPending.load(std::memory_order_relaxed) && resetPending.exchange(false, std::memory_order_acquire))
+        {
+            reset();
+            bypassDelay.reset();
+            silentSamples = 0;
+        }
+
+        prepareBlock();
+
+        bypassMix.setTargetValue(isBypassed ? 1.0f : 0.0f);
+
+        const auto wasSilent = isSilent(buffer);
+
+        const auto isMetering = meteringEnabled.load(std::memory_order_relaxed);
+
+        if (wasSilent && isIdle())
+        {
+            if (isMetering)
+                meter.processSilence(buffer.getNumSamples(), buffer.getNumChannels(), getMeterValue());
+
+            return false;
+        }
+
+        if (bypassDelay.getLatencyInSamples() != getSlotLatency())
+            bypassDelay.setLatency(getSlotLatency());
+
+        dsp::AudioBlock<float> block(buffer);
+
+        // the DSP has not run while bypassed, so it starts over rather than from where it stopped
+        if (! isBypassed && hasSkippedDSP)
+        {
+            reset();
+            hasSkippedDSP = false;
+        }
+
+        if (bypassMix.isSmoothing())
+        {
+            crossfadeBypass(buffer, midiMessages);
+        }
+        else if (isBypassed)
+        {
+            bypassDelay.process(dsp::ProcessContextReplacing<float>(block));
+            hasSkippedDSP = true;
+        }
+        else
+        {
+            bypassDelay.push(block);
+            processBlock(buffer, midiMessages);
+        }
+
+        silentSamples = wasSilent && isSilent(buffer) ? silentSamples + buffer.getNumSamples() : 0;
+
+        if (isMetering)
+            meter.process(buffer, getMeterValue());
+
+        return true;
+    }
 
 protected:
-    bool parametersUpdated = false;
+    // The spec for the channels the slot is configured with, so a mono chain only ever processes
+    // one channel.
+    dsp::ProcessSpec getProcessSpec(double sampleRate, int samplesPerBlock) const
+    {
+        return { sampleRate, (uint32) samplesPerBlock, (uint32) jmax(1, getTotalNumOutputChannels()) };
+    }
+
+    ScratchArena& getScratchArena() noexcept { return sharedArena != nullptr ? *sharedArena : ownArena; }
+
+    void prepareScratch(int numChannels, int maximumBlockSize)
+    {
+        if (sharedArena == nullptr)
+            ownArena.prepare(getSlotScratchSize(numChannels, maximumBlockSize));
+    }
+
+    void setSlotLatency(int latencyInSamples) noexcept { slotLatency.store(latencyInSamples, std::memory_order_relaxed); }
 
 private:
+    bool isFullyBypassed() const noexcept { return bypassMix.getTargetValue() >= 1.0f && ! bypassMix.isSmoothing(); }
+
+    bool processSlotInParts(AudioBuffer<float>& buffer, MidiBuffer& midiMessages, bool isBypassed)
+    {
+        auto hasProcessed = false;
+
+        for (int start = 0; start < buffer.getNumSamples(); start += preparedBlockSize)
+        {
+            const auto length = jmin(preparedBlockSize, buffer.getNumSamples() - start);
+            AudioBuffer<float> part(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), start, length);
+
+            hasProcessed = processSlot(part, midiMessages, isBypassed) || hasProcessed;
+        }
+
+        return hasProcessed;
+    }
+
+    void crossfadeBypass(AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
+    {
+        const auto numSamples = buffer.getNumSamples();
+
+        auto& arena = getScratchArena();
+        ScratchArena::Scope scope(arena);
+
+        dsp::AudioBlock<float> block(buffer);
+        auto dry = arena.allocateBlock(block.getNumChannels(), block.getNumSamples());
+
+        // without room for the dry signal, the bypass switches at once
+        if (dry.getNumChannels() == 0)
+        {
+            bypassMix.setCurrentAndTargetValue(bypassMix.getTargetValue());
+
+            if (isFullyBypassed())
+            {
+                bypassDelay.process(dsp::ProcessContextReplacing<float>(block));
+                hasSkippedDSP = true;
+            }
+            else
+            {
+                bypassDelay.push(block);
+                processBlock(buffer, midiMessages);
+            }
+
+            return;
+        }
+
+        dry.copyFrom(block);
+        bypassDelay.process(dsp::ProcessContextReplacing<float>(dry));
+
+        processBlock(buffer, midiMessages);
+
+        const auto dryGains = bypassMix.getRamp(arena, numSamples);
+
+        for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+        {
+            auto* samples = block.getChannelPointer(channel);
+            auto* drySamples = dry.getChannelPointer(channel);
+
+            for (int i = 0; i < numSamples; ++i)
+                samples[i] += dryGains[i] * (drySamples[i] - samples[i]);
+        }
+    }
+
+    ScratchArena* sharedArena = nullptr;
+    ScratchArena ownArena;
+    std::atomic<int> slotLatency { 0 };
+    int64 silentSamples = 0;
+    std::atomic<bool> resetPending { false };
+
+    LatencyDelay bypassDelay;
+    BlockSmoother bypassMix;
+    bool hasSkippedDSP = false;
+    int preparedBlockSize = 0;
+
+    LevelMeter meter;
+    std::atomic<bool> meteringEnabled { false };
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ProcessorBase)
 };
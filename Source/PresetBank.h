@@ -0,0 +1,194 @@
+#pragma once
+
+#include "BinaryState.h"
+#include "Plugins/ParameterSnapshot.h"
+#include "RealtimePublisher.h"
+
+// Presets that switch on the audio thread.
+//
+// The message thread keeps each preset as a saved state. Whenever the presets or the parameters they
+// set change, it decodes them all ahead of time into one value per parameter, and publishes the lot.
+// select() only stores an index; at the start of its next block the audio thread holds the values the
+// slots read at those of the selected preset, and their smoothers glide to them. The host is told
+// about the new values from the message thread, by notifyHost().
+class PresetBank
+{
+public:
+    static constexpr int maxNumPresets = 128;
+
+    // Maps a decoded state to a value for each of the parameters passed to resolve(), in their order.
+    using Resolver = std::function<std::vector<float>(const BinaryState&)>;
+
+    // message thread
+    int getNumPresets() const noexcept { return presets.size(); }
+
+    // message thread
+    String getName(int index) const { return isPositiveAndBelow(index, presets.size()) ? presets.getReference(index).name : String(); }
+
+    // message thread
+    void setName(int index, const String& newName)
+    {
+        if (isPositiveAndBelow(index, presets.size()))
+            presets.getReference(index).name = newName;
+    }
+
+    // The preset's index, or -1 when the bank is full or the state cannot be read. Call resolve()
+    // afterwards for the audio thread to see it. message thread
+    int add(const String& name, const MemoryBlock& state)
+    {
+        if (presets.size() >= maxNumPresets || ! BinaryState().read(state.getData(), (int) state.getSize()))
+            return -1;
+
+        presets.add(BinaryState::Preset { name, state });
+        return presets.size() - 1;
+    }
+
+    // Replaces the presets with those of a loaded state, keeping the ones that can be read. Call
+    // resolve() afterwards. message thread
+    void restore(const Array<BinaryState::Preset>& presetsToRestore)
+    {
+        presets.clear();
+
+        for (auto& preset : presetsToRestore)
+            add(preset.name, preset.state);
+    }
+
+    // heldValues are what the audio thread holds for each of the parameters, nullptr for one it can
+    // only set by telling the host. message thread
+    void resolve(const Array<AudioProcessorParameter*>& parameters, const Array<HeldParameterValue*>& heldValues, const Resolver& resolver)
+    {
+        jassert(heldValues.size() == parameters.size());
+
+        auto bank = std::make_unique<ResolvedBank>();
+        bank->heldValues = heldValues;
+
+        hostParameters = parameters;
+        hostValues.clear();
+
+        for (auto& preset : presets)
+        {
+            BinaryState state;
+            state.read(preset.state.getData(), (int) preset.state.getSize());
+
+            auto values = resolver(state);
+            values.resize((size_t) parameters.size());
+
+            std::vector<float> heldPresetValues;
+
+            for (size_t i = 0; i < values.size(); ++i)
+            {
+                auto* parameter = parameters.getUnchecked((int) i);
+                values[i] = std::isfinite(values[i]) ? jlimit(0.0f, 1.0f, values[i]) : parameter->getDefaultValue();
+
+                // the slots read plain values, as the host would set them
+                auto* ranged = dynamic_cast<RangedAudioParameter*>(parameter);
+                heldPresetValues.push_back(ranged != nullptr ? ranged->convertFrom0to1(values[i]) : values[i]);
+            }
+
+            hostValues.push_back(std::move(values));
+            bank->values.push_back(std::move(heldPresetValues));
+        }
+
+        publisher.publish(std::move(bank));
+    }
+
+    // any thread
+    void select(int index) noexcept { requested.store(index, std::memory_order_release); }
+
+    // Drops a selection the audio thread has not picked up yet, and the values it holds, e.g. because
+    // a whole state has just been loaded. any thread
+    void cancel() noexcept
+    {
+        requested.store(cancelRequest, std::memory_order_release);
+        applied.store(noRequest, std::memory_order_release);
+    }
+
+    // audio thread, before the parameters are read
+    void process() noexcept
+    {
+        const auto request = requested.exchange(noRequest, std::memory_order_acq_rel);
+
+        // values held for the slots of a chain that is going away would outlast it
+        if (request == cancelRequest || publisher.isPending())
+            if (auto* previous = current)
+                release(*previous);
+
+        auto* bank = current = publisher.acquire();
+
+        if (bank == nullptr)
+            return;
+
+        if (request == cancelRequest)
+        {
+            applied.store(noRequest, std::memory_order_release);
+            return;
+        }
+
+        if (isPositiveAndBelow(request, (int) bank->values.size()))
+        {
+            auto& values = bank->values[(size_t) request];
+
+            for (int i = 0; i < bank->heldValues.size(); ++i)
+                if (auto* heldValue = bank->heldValues.getUnchecked(i))
+                    heldValue->hold(values[(size_t) i]);
+
+            applied.store(request, std::memory_order_release);
+        }
+    }
+
+    // Tells the host about the values of the preset the audio thread last switched to, which also
+    // ends their hold. message thread
+    void notifyHost()
+    {
+        const auto index = applied.exchange(noRequest, std::memory_order_acq_rel);
+
+        if (! isPositiveAndBelow(index, (int) hostValues.size()))
+            return;
+
+        auto& values = hostValues[(size_t) index];
+
+        for (int i = 0; i < hostParameters.size(); ++i)
+        {
+            auto* parameter = hostParameters.getUnchecked(i);
+
+            if (parameter->getValue() != values[(size_t) i])
+                parameter->setValueNotifyingHost(values[(size_t) i]);
+        }
+    }
+
+    // The presets, at the end of a binary state. message thread
+    void write(MemoryOutputStream& stream) const
+    {
+        BinaryState::writePresetCount(stream, presets.size());
+
+        for (auto& preset : presets)
+            BinaryState::writePreset(stream, preset.name, preset.state);
+    }
+
+private:
+    // The presets decoded into the values the audio thread holds.
+    struct ResolvedBank
+    {
+        Array<HeldParameterValue*> heldValues;
+        std::vector<std::vector<float>> values;
+    };
+
+    static constexpr int noRequest = -1;
+    static constexpr int cancelRequest = -2;
+
+    static void release(ResolvedBank& bank) noexcept
+    {
+        for (auto* heldValue : bank.heldValues)
+            if (heldValue != nullptr)
+                heldValue->release();
+    }
+
+    Array<BinaryState::Preset> presets;
+    Array<AudioProcessorParameter*> hostParameters;
+    std::vector<std::vector<float>> hostValues;
+
+    RealtimePublisher<ResolvedBank> publisher;
+    ResolvedBank* current = nullptr;
+    std::atomic<int> requested { noRequest };
+    std::atomic<int> applied { noRequest };
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Hands objects built on the message thread over to the audio thread.
+//
+// publish() swaps a fully built object in through an atomic pointer, acquire() picks the newest one up
+// at the start of a block. The audio thread never allocates, frees or locks: the object it replaces is
+// queued back to the message thread and deleted there on the next publish() or collectGarbage().
+template <typename ObjectType>
+class RealtimePublisher
+{
+public:
+    RealtimePublisher() = default;
+
+    ~RealtimePublisher()
+    {
+        delete pending.exchange(nullptr);
+        delete current;
+
+        collectGarbage();
+    }
+
+    // message thread
+    void publish(std::unique_ptr<ObjectType> object)
+    {
+        collectGarbage();
+
+        // an object the audio thread has not picked up yet was never used, so it can go straight away
+        delete pending.exchange(object.release());
+    }
+
+    // message thread
+    void collectGarbage()
+    {
+        int start1, size1, start2, size2;
+        retiredFifo.prepareToRead(retiredFifo.getNumReady(), start1, size1, start2, size2);
+
+        for (int i = 0; i < size1; ++i)
+            delete retired[(size_t) (start1 + i)];
+
+        for (int i = 0; i < size2; ++i)
+            delete retired[(size_t) (start2 + i)];
+
+        retiredFifo.finishedRead(size1 + size2);
+    }
+
+    // Whether acquire() is about to pick up another object. audio thread
+    bool isPending() const noexcept { return pending.load() != nullptr; }
+
+    // audio thread
+    ObjectType* acquire() noexcept
+    {
+        // while the message thread lags behind on collecting, keep using the current object
+        if (retiredFifo.getFreeSpace() == 0)
+            return current;
+
+        if (auto* next = pending.exchange(nullptr))
+        {
+            if (current != nullptr)
+            {
+                int start1, size1, start2, size2;
+                retiredFifo.prepareToWrite(1, start1, size1, start2, size2);
+                retired[(size_t) start1] = current;
+                retiredFifo.finishedWrite(1);
+            }
+
+            current = next;
+        }
+
+        return current;
+    }
+
+private:
+    static constexpr int retiredCapacity = 32;
+
+    std::atomic<ObjectType*> pending { nullptr };
+    ObjectType* current = nullptr;
+
+    AbstractFifo retiredFifo { retiredCapacity };
+    std::array<ObjectType*, retiredCapacity> retired {};
+
+    JUCE_DECLARE_NON_COPYABLE(RealtimePublisher)
+};
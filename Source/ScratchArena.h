@@ -0,0 +1,112 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Temporary audio memory for the slots of one chain.
+//
+// The slots run one after the other, so they can all borrow from the same memory: prepare() sizes it
+// once on the message thread for the hungriest slot, and on the audio thread each slot takes what
+// it needs inside a Scope, which hands everything back when it ends. Taking is a pointer bump, and
+// the arena never allocates while processing.
+class ScratchArena
+{
+public:
+    ScratchArena() = default;
+
+    // Every allocation starts on a 64 byte boundary.
+    static constexpr size_t alignment = 64 / sizeof(float);
+
+    static constexpr size_t getPaddedSize(size_t numSamples) noexcept
+    {
+        return (numSamples + alignment - 1) / alignment * alignment;
+    }
+
+    static constexpr size_t getBlockSize(size_t numChannels, size_t numSamples) noexcept
+    {
+        return numChannels * getPaddedSize(numSamples);
+    }
+
+    // message thread
+    void prepare(size_t numSamplesToReserve)
+    {
+        if (numSamplesToReserve > capacity)
+        {
+            memory.allocate(numSamplesToReserve + alignment, true);
+            capacity = numSamplesToReserve;
+        }
+
+        auto address = reinterpret_cast<uintptr_t>(memory.get());
+        auto offset = (alignment * sizeof(float) - address % (alignment * sizeof(float))) % (alignment * sizeof(float));
+        data = memory.get() + offset / sizeof(float);
+
+        used = 0;
+        usedChannels = 0;
+    }
+
+    class Scope
+    {
+    public:
+        explicit Scope(ScratchArena& arenaToUse) noexcept
+            : arena(arenaToUse), used(arena.used), usedChannels(arena.usedChannels)
+        {
+        }
+
+        ~Scope()
+        {
+            arena.used = used;
+            arena.usedChannels = usedChannels;
+        }
+
+    private:
+        ScratchArena& arena;
+        size_t used, usedChannels;
+
+        JUCE_DECLARE_NON_COPYABLE(Scope)
+    };
+
+    // nullptr if it does not fit in what is left, so the caller can split its block or fall back.
+    float* allocate(size_t numSamples) noexcept
+    {
+        auto size = getPaddedSize(numSamples);
+
+        if (used + size > capacity)
+        {
+            // the slot asked for more than it reserved through getScratchSize()
+            jassertfalse;
+            return nullptr;
+        }
+
+        auto* result = data + used;
+        used += size;
+        return result;
+    }
+
+    // An empty block, with no channels, if it does not fit in what is left.
+    dsp::AudioBlock<float> allocateBlock(size_t numChannels, size_t numSamples) noexcept
+    {
+        if (usedChannels + numChannels > channels.size() || used + getBlockSize(numChannels, numSamples) > capacity)
+        {
+            jassertfalse;
+            return {};
+        }
+
+        auto* channelPointers = channels.data() + usedChannels;
+        usedChannels += numChannels;
+
+        for (size_t channel = 0; channel < numChannels; ++channel)
+            channelPointers[channel] = allocate(numSamples);
+
+        return { channelPointers, numChannels, numSamples };
+    }
+
+private:
+    HeapBlock<float> memory;
+    float* data = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+
+    std::array<float*, 64> channels {};
+    size_t usedChannels = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(ScratchArena)
+};
@@ -0,0 +1,450 @@
+#include <JuceHeader.h>
+
+#include <numeric>
+
+#include "Common/HeadlessHost.h"
+#include "PluginProcessor.h"
+
+namespace
+{
+using ParameterValues = std::vector<std::pair<String, float>>;
+
+struct Setting
+{
+    String name;
+    ParameterValues values;
+};
+
+struct Target
+{
+    String name;
+    std::function<std::unique_ptr<AudioProcessor>()> create;
+    std::vector<Setting> settings;
+};
+
+struct BenchmarkOptions
+{
+    File outputFile;
+    String filter;
+    double secondsPerRun = 0.5;
+    int repeats = 5;
+    int numChannels = 2;
+    Array<int> blockSizes { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+    Array<double> sampleRates { 44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0 };
+};
+
+struct Measurement
+{
+    double mean = 0.0;
+    double variance = 0.0;
+    double minimum = 0.0;
+    double maximum = 0.0;
+};
+
+template <typename Processor>
+std::function<std::unique_ptr<AudioProcessor>()> factory()
+{
+    return [] { return std::make_unique<Processor>(); };
+}
+
+// With metering, the chain runs as it does while its editor is open.
+std::function<std::unique_ptr<AudioProcessor>()> chainFactory(AmorphetudeAudioProcessor::ChainMode mode, bool metered = false)
+{
+    return [mode, metered] {
+        auto processor = std::make_unique<AmorphetudeAudioProcessor>(mode);
+        processor->setMeteringEnabled(metered);
+
+        return processor;
+    };
+}
+
+std::vector<Target> createTargets()
+{
+    return {
+        { "compressor",
+          factory<CompressorProcessor>(),
+          { { "default", {} },
+            { "heavy",
+              { { PARAMETER_IDs::compressorThreshold, -30.0f },
+                { PARAMETER_IDs::compressorRatio, 8.0f },
+                { PARAMETER_IDs::compressorAttack, 5.0f },
+                { PARAMETER_IDs::compressorRelease, 100.0f } } } } },
+        { "overdrive",
+          factory<OverdriveProcessor>(),
+          { { "default", {} },
+            { "driven",
+              { { PARAMETER_IDs::overdriveTone, 20.0f },
+                { PARAMETER_IDs::overdriveGain, -10.0f },
+                { PARAMETER_IDs::overdriveMixer, 50.0f } } },
+            { "1x", { { PARAMETER_IDs::overdriveOversampling, 0.0f } } },
+            { "8xFIR",
+              { { PARAMETER_IDs::overdriveOversampling, 3.0f },
+                { PARAMETER_IDs::overdriveOversamplingFilter, 1.0f } } } } },
+        { "autowah",
+          factory<AutoWahProcessor>(),
+          { { "default", {} },
+            { "fast",
+              { { PARAMETER_IDs::autowahMode, 3.0f },
+                { PARAMETER_IDs::autowahTempo, 300.0f },
+                { PARAMETER_IDs::autowahRatio, 0.1f } } } } },
+        { "echo",
+          factory<EchoProcessor>(),
+          { { "default", {} },
+            { "feedback",
+              { { PARAMETER_IDs::echoRatio, 1.0f },
+                { PARAMETER_IDs::echoFeedback, -6.0f },
+                { PARAMETER_IDs::echoMix, 50.0f } } } } },
+        { "bitCrushing",
+          factory<BitCrushingProcessor>(),
+          { { "default", {} },
+            { "8bit",
+              { { PARAMETER_IDs::bitCrushingDepth, 0.0f },
+                { PARAMETER_IDs::bitCrushingDitherNoise, -20.0f } } } } },
+        { "chain",
+          chainFactory(AmorphetudeAudioProcessor::ChainMode::dynamic),
+          { { "default", {} },
+            { "allActive", { { PARAMETER_IDs::bitCrushingBypass, 0.0f } } } } },
+        { "chainMetered",
+          chainFactory(AmorphetudeAudioProcessor::ChainMode::dynamic, true),
+          { { "default", {} },
+            { "allActive", { { PARAMETER_IDs::bitCrushingBypass, 0.0f } } } } },
+        { "chainFused",
+          chainFactory(AmorphetudeAudioProcessor::ChainMode::fused),
+          { { "default", {} },
+            { "allActive", { { PARAMETER_IDs::bitCrushingBypass, 0.0f } } } } },
+        { "chainPipelined",
+          chainFactory(AmorphetudeAudioProcessor::ChainMode::pipelined),
+          { { "default", {} },
+            { "allActive", { { PARAMETER_IDs::bitCrushingBypass, 0.0f } } } } },
+    };
+}
+
+void applySetting(AudioProcessor& processor, const Setting& setting)
+{
+    for (auto& value : setting.values)
+    {
+        for (auto* parameter : processor.getParameters())
+        {
+            if (auto* ranged = dynamic_cast<RangedAudioParameter*>(parameter))
+            {
+                if (ranged->paramID == value.first)
+                    ranged->setValueNotifyingHost(ranged->convertTo0to1(value.second));
+            }
+        }
+    }
+}
+
+// A deterministic swept sine plus noise under a repeating decay envelope, so every processor sees its
+// whole operating range (below and above thresholds, envelope attacks and releases).
+AudioBuffer<float> createTestSignal(double sampleRate, int numChannels)
+{
+    AudioBuffer<float> signal(numChannels, (int) sampleRate);
+    Random random(0x616d7068);
+
+    for (int i = 0; i < signal.getNumSamples(); ++i)
+    {
+        auto time = i / sampleRate;
+        auto envelope = (float) std::exp(-6.0 * std::fmod(time, 0.25));
+        auto sine = (float) std::sin(MathConstants<double>::twoPi * (110.0 + 880.0 * time) * time);
+        auto noise = random.nextFloat() * 2.0f - 1.0f;
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            signal.setSample(channel, i, envelope * (0.6f * sine + 0.3f * noise));
+    }
+
+    return signal;
+}
+
+Measurement measure(AudioProcessor& processor, const AudioBuffer<float>& signal, int blockSize, const BenchmarkOptions& options)
+{
+    const auto numChannels = signal.getNumChannels();
+    const auto sampleRate = processor.getSampleRate();
+    const auto samplesPerRun = jmax((int64) blockSize, (int64) (options.secondsPerRun * sampleRate));
+
+    AudioBuffer<float> buffer(numChannels, blockSize);
+    MidiBuffer midi;
+    int readPosition = 0;
+
+    auto runBlocks = [&](int64 numSamples) {
+        int64 ticks = 0;
+
+        for (int64 done = 0; done < numSamples; done += blockSize)
+        {
+            if (readPosition + blockSize > signal.getNumSamples())
+                readPosition = 0;
+
+            for (int channel = 0; channel < numChannels; ++channel)
+                buffer.copyFrom(channel, 0, signal, channel, readPosition, blockSize);
+
+            readPosition += blockSize;
+
+            auto start = Time::getHighResolutionTicks();
+            processor.processBlock(buffer, midi);
+            ticks += Time::getHighResolutionTicks() - start;
+        }
+
+        return ticks;
+    };
+
+    const auto numBlocks = (samplesPerRun + blockSize - 1) / blockSize;
+
+    runBlocks(numBlocks * blockSize / 5);
+
+    std::vector<double> nsPerSample;
+
+    for (int repeat = 0; repeat < options.repeats; ++repeat)
+    {
+        auto ticks = runBlocks(numBlocks * blockSize);
+        nsPerSample.push_back(Time::highResolutionTicksToSeconds(ticks) * 1.0e9 / (double) (numBlocks * blockSize));
+    }
+
+    Measurement result;
+    result.minimum = *std::min_element(nsPerSample.begin(), nsPerSample.end());
+    result.maximum = *std::max_element(nsPerSample.begin(), nsPerSample.end());
+    result.mean = std::accumulate(nsPerSample.begin(), nsPerSample.end(), 0.0) / (double) nsPerSample.size();
+
+    for (auto value : nsPerSample)
+        result.variance += (value - result.mean) * (value - result.mean);
+
+    result.variance /= (double) jmax((size_t) 1, nsPerSample.size() - 1);
+
+    return result;
+}
+
+// Saves and loads the whole chain's state in the binary and in the XML format, in microseconds per
+// call, on the default chain with one more slot.
+var runStateBenchmarks(const BenchmarkOptions& options)
+{
+    struct StateFormat
+    {
+        const char* name;
+        std::function<void(AmorphetudeAudioProcessor&, MemoryBlock&)> save;
+    };
+
+    const StateFormat formats[] { { "binary", [](auto& processor, auto& block) { processor.getStateInformation(block); } },
+                                  { "xml", [](auto& processor, auto& block) { processor.getXmlStateInformation(block); } } };
+    const auto numCalls = jmax(1, (int) (options.secondsPerRun * 1000.0));
+
+    Array<var> results;
+
+    HeadlessHost::callOnMessageThread([&] {
+        AmorphetudeAudioProcessor processor(AmorphetudeAudioProcessor::ChainMode::dynamic);
+        processor.insertSlot(processor.getNumSlots(), PLUGIN_IDs::echo.toString());
+
+        for (auto& format : formats)
+        {
+            MemoryBlock state;
+            std::vector<double> saveTimes, loadTimes;
+
+            for (int repeat = 0; repeat < options.repeats; ++repeat)
+            {
+                auto start = Time::getHighResolutionTicks();
+
+                for (int i = 0; i < numCalls; ++i)
+                {
+                    state.reset();
+                    format.save(processor, state);
+                }
+
+                saveTimes.push_back(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1.0e6 / numCalls);
+
+                start = Time::getHighResolutionTicks();
+
+                for (int i = 0; i < numCalls; ++i)
+                    processor.setStateInformation(state.getData(), (int) state.getSize());
+
+                loadTimes.push_back(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1.0e6 / numCalls);
+            }
+
+            const auto save = *std::min_element(saveTimes.begin(), saveTimes.end());
+            const auto load = *std::min_element(loadTimes.begin(), loadTimes.end());
+
+            std::cerr << "state / " << format.name << ": " << (int) state.getSize() << " bytes, save " << String(save, 2)
+                      << " us, load " << String(load, 2) << " us" << std::endl;
+
+            auto* result = new DynamicObject();
+            result->setProperty("format", format.name);
+            result->setProperty("sizeInBytes", (int) state.getSize());
+            result->setProperty("saveMicrosecondsMin", save);
+            result->setProperty("loadMicrosecondsMin", load);
+            results.add(var(result));
+        }
+    });
+
+    return results;
+}
+
+var runBenchmarks(const BenchmarkOptions& options)
+{
+    Array<var> results;
+
+    for (auto& target : createTargets())
+    {
+        if (options.filter.isNotEmpty() && ! target.name.containsIgnoreCase(options.filter))
+            continue;
+
+        for (auto& setting : target.settings)
+        {
+            for (auto sampleRate : options.sampleRates)
+            {
+                auto signal = createTestSignal(sampleRate, options.numChannels);
+
+                for (auto blockSize : options.blockSizes)
+                {
+                    std::unique_ptr<AudioProcessor> processor;
+
+                    HeadlessHost::callOnMessageThread([&] {
+                        processor = target.create();
+                        HeadlessHost::setChannelCount(*processor, options.numChannels);
+                        applySetting(*processor, setting);
+                    });
+
+                    HeadlessHost::prepare(*processor, sampleRate, blockSize, false);
+
+                    auto measurement = measure(*processor, signal, blockSize, options);
+                    auto realtimeMultiple = 1.0e9 / sampleRate / measurement.mean;
+
+                    HeadlessHost::callOnMessageThread([&] {
+                        processor->releaseResources();
+                        processor.reset();
+                    });
+
+                    std::cerr << target.name << " / " << setting.name << " @ " << sampleRate << " Hz, " << blockSize
+                              << " samples: " << String(measurement.mean, 2) << " ns/sample, "
+                              << String(realtimeMultiple, 1) << "x realtime" << std::endl;
+
+                    auto* result = new DynamicObject();
+                    result->setProperty("target", target.name);
+                    result->setProperty("setting", setting.name);
+                    result->setProperty("sampleRate", sampleRate);
+                    result->setProperty("blockSize", blockSize);
+                    result->setProperty("nsPerSampleMean", measurement.mean);
+                    result->setProperty("nsPerSampleVariance", measurement.variance);
+                    result->setProperty("nsPerSampleStdDev", std::sqrt(measurement.variance));
+                    result->setProperty("nsPerSampleMin", measurement.minimum);
+                    result->setProperty("nsPerSampleMax", measurement.maximum);
+                    result->setProperty("realtimeMultiple", realtimeMultiple);
+                    results.add(var(result));
+                }
+            }
+        }
+    }
+
+    auto* system = new DynamicObject();
+    system->setProperty("cpu", SystemStats::getCpuModel());
+    system->setProperty("numCpus", SystemStats::getNumCpus());
+    system->setProperty("os", SystemStats::getOperatingSystemName());
+#if JUCE_DEBUG
+    system->setProperty("build", "debug");
+#else
+    system->setProperty("build", "release");
+#endif
+
+    auto* config = new DynamicObject();
+    config->setProperty("secondsPerRun", options.secondsPerRun);
+    config->setProperty("repeats", options.repeats);
+    config->setProperty("numChannels", options.numChannels);
+
+    auto* report = new DynamicObject();
+    report->setProperty("version", ProjectInfo::versionString);
+    report->setProperty("timestamp", Time::getCurrentTime().toISO8601(true));
+    report->setProperty("system", var(system));
+    report->setProperty("config", var(config));
+    report->setProperty("results", results);
+
+    if (options.filter.isEmpty() || options.filter.equalsIgnoreCase("state"))
+        report->setProperty("state", runStateBenchmarks(options));
+
+    return var(report);
+}
+
+template <typename Type>
+Array<Type> parseList(const String& text)
+{
+    Array<Type> values;
+
+    for (auto& token : StringArray::fromTokens(text, ",", {}))
+        values.add((Type) token.trim().getDoubleValue());
+
+    return values;
+}
+
+void printUsage()
+{
+    std::cout << "Usage: AmorphetudeBenchmark [options]" << std::endl
+              << std::endl
+              << "Measures the cost of each effect slot and of the whole chain, and reports it as JSON." << std::endl
+              << "ns/sample figures are per sample frame, covering all channels. The \"state\" section times" << std::endl
+              << "saving and loading the chain's state in the binary and in the old XML format." << std::endl
+              << std::endl
+              << "  --output <file>          write the JSON report to a file instead of stdout" << std::endl
+              << "  --filter <text>          only run targets whose name contains the text, or \"state\" for only the state timings" << std::endl
+              << "  --seconds <s>            seconds of audio per measured run (default: 0.5)" << std::endl
+              << "  --repeats <n>            measured runs per configuration (default: 5)" << std::endl
+              << "  --channels <n>           channels to process, 1 to 16 (default: 2)" << std::endl
+              << "  --block-sizes <a,b,...>  block sizes to sweep (default: 16 to 4096)" << std::endl
+              << "  --sample-rates <a,b,...> sample rates to sweep (default: 44100 to 192000)" << std::endl;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    ArgumentList args(argc, argv);
+    BenchmarkOptions options;
+
+    if (args.containsOption("--help|-h"))
+    {
+        printUsage();
+        return 0;
+    }
+
+    if (args.containsOption("--output"))
+        options.outputFile = File::getCurrentWorkingDirectory().getChildFile(args.removeValueForOption("--output"));
+
+    if (args.containsOption("--filter"))
+        options.filter = args.removeValueForOption("--filter");
+
+    if (args.containsOption("--seconds"))
+        options.secondsPerRun = args.removeValueForOption("--seconds").getDoubleValue();
+
+    if (args.containsOption("--repeats"))
+        options.repeats = args.removeValueForOption("--repeats").getIntValue();
+
+    if (args.containsOption("--channels"))
+        options.numChannels = args.removeValueForOption("--channels").getIntValue();
+
+    if (args.containsOption("--block-sizes"))
+        options.blockSizes = parseList<int>(args.removeValueForOption("--block-sizes"));
+
+    if (args.containsOption("--sample-rates"))
+        options.sampleRates = parseList<double>(args.removeValueForOption("--sample-rates"));
+
+    if (options.secondsPerRun <= 0.0 || options.repeats <= 0 || options.numChannels < 1 || options.numChannels > ProcessorBase::maxNumChannels || options.blockSizes.isEmpty() || options.sampleRates.isEmpty())
+    {
+        printUsage();
+        return 1;
+    }
+
+    return HeadlessHost::run([&] {
+        auto json = JSON::toString(runBenchmarks(options));
+
+#if AMORPHETUDE_VERIFY_QUANTIZER
+        if (auto numMismatches = NoiseShapedQuantizer::getNumMismatches())
+            std::cerr << "The quantizer differed from its reference loop in " << (int64) numMismatches << " blocks" << std::endl;
+#endif
+
+        if (options.outputFile == File())
+        {
+            std::cout << json << std::endl;
+            return 0;
+        }
+
+        if (! options.outputFile.replaceWithText(json))
+        {
+            std::cerr << "Cannot write " << options.outputFile.getFullPathName() << std::endl;
+            return 1;
+        }
+
+        return 0;
+    });
+}
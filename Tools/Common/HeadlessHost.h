@@ -0,0 +1,88 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <thread>
+
+// Minimal stand-in for a plugin host, used by the command line tools.
+//
+// The calling thread becomes the message thread and keeps dispatching messages while the job runs on
+// a separate thread, so anything the processors defer to the message thread is serviced the same way
+// it would be inside a DAW.
+namespace HeadlessHost
+{
+inline int run(std::function<int()> job)
+{
+    ScopedJuceInitialiser_GUI juceInitialiser;
+
+    auto* messageManager = MessageManager::getInstance();
+    int result = 0;
+
+    std::thread worker([&] {
+        result = job();
+        messageManager->stopDispatchLoop();
+    });
+
+    messageManager->runDispatchLoop();
+    worker.join();
+
+    return result;
+}
+
+inline void callOnMessageThread(std::function<void()> function)
+{
+    if (MessageManager::getInstance()->isThisTheMessageThread())
+    {
+        function();
+        return;
+    }
+
+    WaitableEvent finished;
+
+    MessageManager::callAsync([&] {
+        function();
+        finished.signal();
+    });
+
+    finished.wait();
+}
+
+// Messages are delivered in order, so once this returns everything posted before it has been handled.
+inline void waitForMessageThread()
+{
+    callOnMessageThread([] {});
+}
+
+inline bool setChannelCount(AudioProcessor& processor, int numChannels)
+{
+    auto channelSet = AudioChannelSet::canonicalChannelSet(numChannels);
+
+    if (channelSet.isDisabled())
+        return false;
+
+    AudioProcessor::BusesLayout layout;
+    layout.inputBuses.add(channelSet);
+    layout.outputBuses.add(channelSet);
+
+    return processor.setBusesLayout(layout);
+}
+
+// Prepares the processor the way a host does before starting playback and pushes one silent block
+// through it, so that processing set up lazily on the first block is in place before real audio arrives.
+inline void prepare(AudioProcessor& processor, double sampleRate, int blockSize, bool isNonRealtime)
+{
+    callOnMessageThread([&] {
+        processor.setNonRealtime(isNonRealtime);
+        processor.setRateAndBufferSizeDetails(sampleRate, blockSize);
+        processor.prepareToPlay(sampleRate, blockSize);
+    });
+
+    AudioBuffer<float> silence(processor.getTotalNumInputChannels(), blockSize);
+    MidiBuffer midi;
+
+    silence.clear();
+    processor.processBlock(silence, midi);
+
+    waitForMessageThread();
+}
+} // namespace HeadlessHost
@@ -0,0 +1,394 @@
+#include <JuceHeader.h>
+
+#include <optional>
+#include <thread>
+
+#include "Common/HeadlessHost.h"
+#include "PluginProcessor.h"
+#include "RealtimeGuard.h"
+
+namespace
+{
+struct CheckOptions
+{
+    String filter;
+    double sampleRate = 48000.0;
+    int blockSize = 256;
+    int blocksPerStep = 8;
+    bool isStrict = true;
+};
+
+// What the audio thread and the pipelined chain's workers are doing, for the reports.
+std::atomic<const char*> checkContext { "" };
+
+thread_local std::optional<RealtimeGuard::ScopedCheck> workerCheck;
+
+// Checks a worker of the pipelined chain while it runs a stage, but not while it waits for the next.
+void checkWorkerStage(bool isStarting)
+{
+    if (isStarting)
+        workerCheck.emplace(checkContext.load());
+    else
+        workerCheck.reset();
+}
+
+// One thing a host or the editor does to a processor while it plays: either between two blocks on
+// the audio thread, or on the message thread while the blocks keep coming.
+struct Step
+{
+    String name;
+    bool isOnAudioThread = false;
+    std::function<void()> action;
+};
+
+// A processor playing on an audio thread of its own, with everything that thread does checked.
+struct Session
+{
+    std::unique_ptr<AudioProcessor> processor;
+    std::function<void(AudioBuffer<float>&, MidiBuffer&)> process;
+
+    std::atomic<bool> shouldStop { false };
+    std::atomic<int64> numBlocks { 0 };
+    std::atomic<Step*> pendingStep { nullptr };
+
+    // audio thread
+    bool isSilent = false;
+    bool isSlotBypassed = false;
+    Random audioRandom { 1 };
+
+    // message thread
+    Random messageRandom { 2 };
+};
+
+struct Target
+{
+    String name;
+    std::function<std::unique_ptr<AudioProcessor>()> create;
+};
+
+template <typename Processor>
+std::function<std::unique_ptr<AudioProcessor>()> factory()
+{
+    return [] { return std::make_unique<Processor>(); };
+}
+
+std::function<std::unique_ptr<AudioProcessor>()> chainFactory(AmorphetudeAudioProcessor::ChainMode mode)
+{
+    return [mode] { return std::make_unique<AmorphetudeAudioProcessor>(mode); };
+}
+
+std::vector<Target> createTargets()
+{
+    return {
+        { "compressor", factory<CompressorProcessor>() },
+        { "overdrive", factory<OverdriveProcessor>() },
+        { "autowah", factory<AutoWahProcessor>() },
+        { "echo", factory<EchoProcessor>() },
+        { "bitCrushing", factory<BitCrushingProcessor>() },
+        { "chain", chainFactory(AmorphetudeAudioProcessor::ChainMode::dynamic) },
+        { "chainFused", chainFactory(AmorphetudeAudioProcessor::ChainMode::fused) },
+        { "chainPipelined", chainFactory(AmorphetudeAudioProcessor::ChainMode::pipelined) },
+    };
+}
+
+void setRandomValues(AudioProcessor& processor, Random& random)
+{
+    for (auto* parameter : processor.getParameters())
+        parameter->setValueNotifyingHost(random.nextFloat());
+}
+
+void setBypassValues(AudioProcessor& processor, float value)
+{
+    for (auto* parameter : processor.getParameters())
+    {
+        if (auto* ranged = dynamic_cast<RangedAudioParameter*>(parameter))
+        {
+            if (ranged->paramID.endsWith("Bypass"))
+                ranged->setValueNotifyingHost(value);
+        }
+    }
+}
+
+// What every processor goes through: automation from the host on the audio thread, edits from the
+// editor on the message thread, silence, and loading the state it started with.
+std::vector<Step> createSteps(Session& session)
+{
+    auto& processor = *session.processor;
+
+    std::vector<Step> steps {
+        { "automation", true, [&] { setRandomValues(processor, session.audioRandom); } },
+        { "parameter edits", false, [&] { setRandomValues(processor, session.messageRandom); } },
+        { "silence", true, [&] { session.isSilent = true; } },
+        { "signal", true, [&] { session.isSilent = false; } },
+    };
+
+    if (auto* chain = dynamic_cast<AmorphetudeAudioProcessor*>(&processor))
+    {
+        auto initialState = std::make_shared<MemoryBlock>();
+        chain->getStateInformation(*initialState);
+
+        std::vector<Step> chainSteps {
+            { "bypass all", false, [&] { setBypassValues(processor, 1.0f); } },
+            { "enable all", false, [&] { setBypassValues(processor, 0.0f); } },
+            { "select effect",
+              false,
+              [chain] {
+                  auto& selector = chain->getEffectSelector();
+                  const auto next = (roundToInt(selector.convertFrom0to1(selector.getValue())) + 1) % (int) selector.getNumSteps();
+                  selector.setValueNotifyingHost(selector.convertTo0to1((float) next));
+              } },
+            { "insert slot", false, [chain] { chain->insertSlot(0, PLUGIN_IDs::echo.toString()); } },
+            { "move slot", false, [chain] { chain->moveSlot(0, chain->getNumSlots() - 1); } },
+            { "remove slot", false, [chain] { chain->removeSlot(chain->getNumSlots() - 1); } },
+            { "add preset", false, [chain] { chain->addPreset("Check"); } },
+            { "switch preset", false, [chain] { chain->setCurrentProgram(chain->getNumPrograms() - 1); } },
+            { "switch preset back", false, [chain] { chain->setCurrentProgram(0); } },
+            { "metering on", false, [chain] { chain->setMeteringEnabled(true); } },
+            { "pull meters",
+              false,
+              [chain] {
+                  MeterReading reading;
+                  SpectrumAnalyzer::Spectrum spectrum;
+
+                  chain->pullOutputMeter(reading);
+                  chain->getSpectrum(spectrum);
+
+                  for (int index = 0; index < chain->getNumSlots(); ++index)
+                      chain->pullSlotMeter(index, reading);
+              } },
+            { "metering off", false, [chain] { chain->setMeteringEnabled(false); } },
+            { "load state", false, [chain, initialState] { chain->setStateInformation(initialState->getData(), (int) initialState->getSize()); } },
+            { "load XML state",
+              false,
+              [chain] {
+                  MemoryBlock state;
+                  chain->getXmlStateInformation(state);
+                  chain->setStateInformation(state.getData(), (int) state.getSize());
+              } },
+        };
+
+        steps.insert(steps.end(), chainSteps.begin(), chainSteps.end());
+    }
+    else if (auto* slot = dynamic_cast<ProcessorBase*>(&processor))
+    {
+        auto initialState = std::make_shared<ValueTree>(slot->getParametersValueTree());
+
+        std::vector<Step> slotSteps {
+            { "bypass", true, [&] { session.isSlotBypassed = true; } },
+            { "enable", true, [&] { session.isSlotBypassed = false; } },
+            { "load state", false, [slot, initialState] { slot->updateParameters(*initialState); } },
+        };
+
+        steps.insert(steps.end(), slotSteps.begin(), slotSteps.end());
+    }
+
+    return steps;
+}
+
+// A swept sine plus noise under a repeating decay envelope, so envelopes attack and release and the
+// slots go idle in between now and then.
+AudioBuffer<float> createTestSignal(double sampleRate, int numChannels)
+{
+    AudioBuffer<float> signal(numChannels, (int) sampleRate);
+    Random random(0x616d7068);
+
+    for (int i = 0; i < signal.getNumSamples(); ++i)
+    {
+        auto time = i / sampleRate;
+        auto envelope = (float) std::exp(-6.0 * std::fmod(time, 0.25));
+        auto sine = (float) std::sin(MathConstants<double>::twoPi * (110.0 + 880.0 * time) * time);
+        auto noise = random.nextFloat() * 2.0f - 1.0f;
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            signal.setSample(channel, i, envelope * (0.6f * sine + 0.3f * noise));
+    }
+
+    return signal;
+}
+
+// audio thread
+void playUntilStopped(Session& session, const AudioBuffer<float>& signal, int blockSize)
+{
+    ScopedNoDenormals noDenormals;
+
+    const auto numChannels = signal.getNumChannels();
+    AudioBuffer<float> buffer(numChannels, blockSize);
+    MidiBuffer midi;
+    midi.ensureSize(256);
+    int readPosition = 0;
+
+    while (! session.shouldStop.load())
+    {
+        RealtimeGuard::ScopedCheck check(checkContext.load());
+
+        if (auto* step = session.pendingStep.exchange(nullptr))
+            step->action();
+
+        if (session.isSilent)
+        {
+            buffer.clear();
+        }
+        else
+        {
+            if (readPosition + blockSize > signal.getNumSamples())
+                readPosition = 0;
+
+            for (int channel = 0; channel < numChannels; ++channel)
+                buffer.copyFrom(channel, 0, signal, channel, readPosition, blockSize);
+
+            readPosition += blockSize;
+        }
+
+        midi.clear();
+        session.process(buffer, midi);
+        session.numBlocks.fetch_add(1);
+    }
+}
+
+void waitForBlocks(const Session& session, int numBlocks)
+{
+    const auto target = session.numBlocks.load() + numBlocks;
+
+    while (session.numBlocks.load() < target)
+        Thread::sleep(1);
+}
+
+// Returns how many violations the target's audio thread had.
+int checkTarget(const Target& target, const CheckOptions& options)
+{
+    const auto numChannels = 2;
+    const auto firstViolation = RealtimeGuard::getNumViolations();
+
+    Session session;
+
+    HeadlessHost::callOnMessageThread([&] {
+        session.processor = target.create();
+        HeadlessHost::setChannelCount(*session.processor, numChannels);
+    });
+
+    HeadlessHost::prepare(*session.processor, options.sampleRate, options.blockSize, false);
+
+    if (auto* slot = dynamic_cast<ProcessorBase*>(session.processor.get()))
+    {
+        HeadlessHost::callOnMessageThread([&] { slot->prepareBypass(numChannels, options.blockSize, false); });
+
+        session.process = [&session, slot](AudioBuffer<float>& buffer, MidiBuffer& midi) { slot->processSlot(buffer, midi, session.isSlotBypassed); };
+    }
+    else
+    {
+        session.process = [&session](AudioBuffer<float>& buffer, MidiBuffer& midi) { session.processor->processBlock(buffer, midi); };
+    }
+
+    std::vector<Step> steps;
+    HeadlessHost::callOnMessageThread([&] { steps = createSteps(session); });
+
+    StringArray contexts;
+
+    for (auto& step : steps)
+        contexts.add(target.name + " / " + step.name + (step.isOnAudioThread ? "" : " (message thread)"));
+
+    contexts.add(target.name);
+    checkContext.store(contexts[contexts.size() - 1].toRawUTF8());
+
+    const auto signal = createTestSignal(options.sampleRate, numChannels);
+    std::thread audioThread([&] { playUntilStopped(session, signal, options.blockSize); });
+
+    waitForBlocks(session, options.blocksPerStep);
+
+    for (size_t index = 0; index < steps.size(); ++index)
+    {
+        auto& step = steps[index];
+        checkContext.store(contexts[(int) index].toRawUTF8());
+
+        if (step.isOnAudioThread)
+            session.pendingStep.store(&step);
+        else
+            HeadlessHost::callOnMessageThread(step.action);
+
+        waitForBlocks(session, options.blocksPerStep);
+    }
+
+    session.shouldStop.store(true);
+    audioThread.join();
+
+    HeadlessHost::callOnMessageThread([&] {
+        session.processor->releaseResources();
+        session.processor.reset();
+    });
+
+    return RealtimeGuard::getNumViolations() - firstViolation;
+}
+
+void printUsage()
+{
+    std::cout << "Usage: AmorphetudeRealtimeCheck [options]" << std::endl
+              << std::endl
+              << "Plays every effect slot and the whole chain on an audio thread while a script automates" << std::endl
+              << "parameters, toggles bypasses, edits the chain, switches presets and loads states. Any heap" << std::endl
+              << "allocation, lock, yield or system call on the audio thread, or on a worker of the pipelined" << std::endl
+              << "chain while it runs a stage, is reported with a stack trace, and the exit code is 1 if" << std::endl
+              << "there was any." << std::endl
+              << std::endl
+              << "  --filter <text>          only check targets whose name contains the text" << std::endl
+              << "  --sample-rate <hz>       sample rate to play at (default: 48000)" << std::endl
+              << "  --block-size <n>         samples per block (default: 256)" << std::endl
+              << "  --blocks-per-step <n>    blocks played after each step of the script (default: 8)" << std::endl
+              << "  --allow-free-locks       only report locks that had to wait for another thread" << std::endl;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    RealtimeGuard::prepare();
+
+    ArgumentList args(argc, argv);
+    CheckOptions options;
+
+    if (args.containsOption("--help|-h"))
+    {
+        printUsage();
+        return 0;
+    }
+
+    if (args.containsOption("--filter"))
+        options.filter = args.removeValueForOption("--filter");
+
+    if (args.containsOption("--sample-rate"))
+        options.sampleRate = args.removeValueForOption("--sample-rate").getDoubleValue();
+
+    if (args.containsOption("--block-size"))
+        options.blockSize = args.removeValueForOption("--block-size").getIntValue();
+
+    if (args.containsOption("--blocks-per-step"))
+        options.blocksPerStep = args.removeValueForOption("--blocks-per-step").getIntValue();
+
+    options.isStrict = ! args.removeOptionIfFound("--allow-free-locks");
+
+    if (options.sampleRate <= 0.0 || options.blockSize <= 0 || options.blocksPerStep <= 0)
+    {
+        printUsage();
+        return 1;
+    }
+
+    RealtimeGuard::setStrict(options.isStrict);
+    PipelinedChain::setWorkerStageHook(checkWorkerStage);
+
+    return HeadlessHost::run([&] {
+        auto numFailed = 0;
+
+        for (auto& target : createTargets())
+        {
+            if (options.filter.isNotEmpty() && ! target.name.containsIgnoreCase(options.filter))
+                continue;
+
+            const auto numViolations = checkTarget(target, options);
+
+            std::cout << target.name << ": " << (numViolations == 0 ? String("ok") : String(numViolations) + " violations") << std::endl;
+
+            if (numViolations > 0)
+                ++numFailed;
+        }
+
+        return numFailed > 0 ? 1 : 0;
+    });
+}
@@ -0,0 +1,392 @@
+// The fortified inline wrappers of read() and open() would clash with the definitions below.
+#undef _FORTIFY_SOURCE
+
+#include "RealtimeGuard.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+
+// glibc's own allocator, which the replacements below forward to.
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* pointer);
+}
+
+namespace
+{
+constexpr int maxReports = 20;
+constexpr int maxFrames = 48;
+
+thread_local bool isChecking = false;
+thread_local bool isReporting = false;
+thread_local const char* checkContext = "";
+
+std::atomic<int> numViolations { 0 };
+std::atomic<bool> isStrict { true };
+
+bool shouldReport() noexcept { return isChecking && ! isReporting; }
+
+// Prints the first maxReports with a stack trace and counts the rest. Anything called from here runs
+// unchecked.
+void report(const char* call) noexcept
+{
+    isReporting = true;
+
+    if (numViolations.fetch_add(1) < maxReports)
+    {
+        void* frames[maxFrames];
+        const auto numFrames = backtrace(frames, maxFrames);
+
+        dprintf(STDERR_FILENO, "\nRealtime violation in %s: %s\n", checkContext, call);
+        backtrace_symbols_fd(frames + 1, numFrames - 1, STDERR_FILENO);
+    }
+
+    isReporting = false;
+}
+
+// The C library's definition of a function replaced below. Every thread resolves the same address,
+// and prepare() resolves them all before any check.
+template <typename Function>
+Function next(Function& resolved, const char* name) noexcept
+{
+    if (resolved == nullptr)
+        resolved = reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+
+    return resolved;
+}
+
+int (*realMutexLock)(pthread_mutex_t*) = nullptr;
+int (*realMutexTrylock)(pthread_mutex_t*) = nullptr;
+int (*realCondWait)(pthread_cond_t*, pthread_mutex_t*) = nullptr;
+int (*realCondTimedwait)(pthread_cond_t*, pthread_mutex_t*, const timespec*) = nullptr;
+int (*realSemWait)(sem_t*) = nullptr;
+int (*realSemTimedwait)(sem_t*, const timespec*) = nullptr;
+ssize_t (*realRead)(int, void*, size_t) = nullptr;
+ssize_t (*realWrite)(int, const void*, size_t) = nullptr;
+int (*realOpen)(const char*, int, ...) = nullptr;
+int (*realOpenat)(int, const char*, int, ...) = nullptr;
+int (*realClose)(int) = nullptr;
+int (*realNanosleep)(const timespec*, timespec*) = nullptr;
+int (*realClockNanosleep)(clockid_t, int, const timespec*, timespec*) = nullptr;
+int (*realUsleep)(useconds_t) = nullptr;
+int (*realSchedYield)() = nullptr;
+int (*realPoll)(pollfd*, nfds_t, int) = nullptr;
+int (*realSelect)(int, fd_set*, fd_set*, fd_set*, timeval*) = nullptr;
+long (*realSyscall)(long, ...) = nullptr;
+
+// The mode argument of open() and openat() is only passed when the flags ask for one.
+bool hasMode(int flags) noexcept { return (flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE; }
+} // namespace
+
+namespace RealtimeGuard
+{
+void prepare()
+{
+    next(realMutexLock, "pthread_mutex_lock");
+    next(realMutexTrylock, "pthread_mutex_trylock");
+    next(realCondWait, "pthread_cond_wait");
+    next(realCondTimedwait, "pthread_cond_timedwait");
+    next(realSemWait, "sem_wait");
+    next(realSemTimedwait, "sem_timedwait");
+    next(realRead, "read");
+    next(realWrite, "write");
+    next(realOpen, "open");
+    next(realOpenat, "openat");
+    next(realClose, "close");
+    next(realNanosleep, "nanosleep");
+    next(realClockNanosleep, "clock_nanosleep");
+    next(realUsleep, "usleep");
+    next(realSchedYield, "sched_yield");
+    next(realPoll, "poll");
+    next(realSelect, "select");
+    next(realSyscall, "syscall");
+
+    // the first backtrace() loads the unwinder
+    void* frames[1];
+    backtrace(frames, 1);
+}
+
+void setStrict(bool shouldCountEveryLock) { isStrict.store(shouldCountEveryLock); }
+
+int getNumViolations() { return numViolations.load(); }
+
+ScopedCheck::ScopedCheck(const char* context) : wasChecking(isChecking), previousContext(checkContext)
+{
+    checkContext = context;
+    isChecking = true;
+}
+
+ScopedCheck::~ScopedCheck()
+{
+    isChecking = wasChecking;
+    checkContext = previousContext;
+}
+} // namespace RealtimeGuard
+
+extern "C"
+{
+void* malloc(size_t size) noexcept
+{
+    if (shouldReport())
+        report("malloc");
+
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) noexcept
+{
+    if (shouldReport())
+        report("calloc");
+
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) noexcept
+{
+    if (shouldReport())
+        report("realloc");
+
+    return __libc_realloc(pointer, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept
+{
+    if (shouldReport())
+        report("memalign");
+
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    if (shouldReport())
+        report("aligned_alloc");
+
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** result, size_t alignment, size_t size) noexcept
+{
+    if (shouldReport())
+        report("posix_memalign");
+
+    *result = __libc_memalign(alignment, size);
+    return *result != nullptr ? 0 : ENOMEM;
+}
+
+void free(void* pointer) noexcept
+{
+    if (pointer != nullptr && shouldReport())
+        report("free");
+
+    __libc_free(pointer);
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept
+{
+    if (! shouldReport())
+        return next(realMutexLock, "pthread_mutex_lock")(mutex);
+
+    if (next(realMutexTrylock, "pthread_mutex_trylock")(mutex) == 0)
+    {
+        if (isStrict.load(std::memory_order_relaxed))
+            report("pthread_mutex_lock");
+
+        return 0;
+    }
+
+    report("pthread_mutex_lock, waiting for another thread");
+    return next(realMutexLock, "pthread_mutex_lock")(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t* condition, pthread_mutex_t* mutex)
+{
+    if (shouldReport())
+        report("pthread_cond_wait");
+
+    return next(realCondWait, "pthread_cond_wait")(condition, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t* condition, pthread_mutex_t* mutex, const timespec* time)
+{
+    if (shouldReport())
+        report("pthread_cond_timedwait");
+
+    return next(realCondTimedwait, "pthread_cond_timedwait")(condition, mutex, time);
+}
+
+int sem_wait(sem_t* semaphore)
+{
+    if (shouldReport())
+        report("sem_wait");
+
+    return next(realSemWait, "sem_wait")(semaphore);
+}
+
+int sem_timedwait(sem_t* semaphore, const timespec* time)
+{
+    if (shouldReport())
+        report("sem_timedwait");
+
+    return next(realSemTimedwait, "sem_timedwait")(semaphore, time);
+}
+
+ssize_t read(int fd, void* buffer, size_t size)
+{
+    if (shouldReport())
+        report("read");
+
+    return next(realRead, "read")(fd, buffer, size);
+}
+
+ssize_t write(int fd, const void* buffer, size_t size)
+{
+    if (shouldReport())
+        report("write");
+
+    return next(realWrite, "write")(fd, buffer, size);
+}
+
+int open(const char* path, int flags, ...)
+{
+    mode_t mode = 0;
+
+    if (hasMode(flags))
+    {
+        va_list args;
+        va_start(args, flags);
+        mode = (mode_t) va_arg(args, int);
+        va_end(args);
+    }
+
+    if (shouldReport())
+        report("open");
+
+    return next(realOpen, "open")(path, flags, mode);
+}
+
+int openat(int directory, const char* path, int flags, ...)
+{
+    mode_t mode = 0;
+
+    if (hasMode(flags))
+    {
+        va_list args;
+        va_start(args, flags);
+        mode = (mode_t) va_arg(args, int);
+        va_end(args);
+    }
+
+    if (shouldReport())
+        report("openat");
+
+    return next(realOpenat, "openat")(directory, path, flags, mode);
+}
+
+int close(int fd)
+{
+    if (shouldReport())
+        report("close");
+
+    return next(realClose, "close")(fd);
+}
+
+int nanosleep(const timespec* duration, timespec* remaining)
+{
+    if (shouldReport())
+        report("nanosleep");
+
+    return next(realNanosleep, "nanosleep")(duration, remaining);
+}
+
+int clock_nanosleep(clockid_t clock, int flags, const timespec* time, timespec* remaining)
+{
+    if (shouldReport())
+        report("clock_nanosleep");
+
+    return next(realClockNanosleep, "clock_nanosleep")(clock, flags, time, remaining);
+}
+
+int usleep(useconds_t microseconds)
+{
+    if (shouldReport())
+        report("usleep");
+
+    return next(realUsleep, "usleep")(microseconds);
+}
+
+// Yielding hands the core to whatever else is ready, and the thread may not get it back for a whole
+// time slice.
+int sched_yield() noexcept
+{
+    if (shouldReport())
+        report("sched_yield");
+
+    return next(realSchedYield, "sched_yield")();
+}
+
+// The header maps pthread_yield() onto sched_yield(), but the C library still exports it for code
+// built against older headers.
+int checkedPthreadYield() noexcept __asm__("pthread_yield");
+
+int checkedPthreadYield() noexcept
+{
+    if (shouldReport())
+        report("pthread_yield");
+
+    return next(realSchedYield, "sched_yield")();
+}
+
+int poll(pollfd* fds, nfds_t numFds, int timeout)
+{
+    if (shouldReport())
+        report("poll");
+
+    return next(realPoll, "poll")(fds, numFds, timeout);
+}
+
+int select(int numFds, fd_set* readFds, fd_set* writeFds, fd_set* exceptFds, timeval* timeout)
+{
+    if (shouldReport())
+        report("select");
+
+    return next(realSelect, "select")(numFds, readFds, writeFds, exceptFds, timeout);
+}
+
+// Forwards the six arguments the kernel takes, whether the caller passed them or not.
+long syscall(long number, ...) noexcept
+{
+    va_list args;
+    va_start(args, number);
+
+    long arguments[6];
+
+    for (auto& argument : arguments)
+        argument = va_arg(args, long);
+
+    va_end(args);
+
+    if (shouldReport())
+        report("syscall");
+
+    return next(realSyscall, "syscall")(number, arguments[0], arguments[1], arguments[2], arguments[3], arguments[4], arguments[5]);
+}
+}
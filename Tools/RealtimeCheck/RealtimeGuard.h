@@ -0,0 +1,38 @@
+#pragma once
+
+// Catches what an audio thread must never do: allocate or free heap memory, wait on a lock, or enter
+// the kernel.
+//
+// RealtimeGuard.cpp replaces the C library's entry points for these (malloc and friends, pthread
+// mutexes, condition variables and semaphores, yielding, and the usual blocking system calls) for the whole
+// executable. A thread inside a ScopedCheck that calls one of them has the call counted and a stack
+// trace printed to stderr; other threads are not affected. Linux with glibc only.
+namespace RealtimeGuard
+{
+// Resolves the C library's own functions and loads what printing a stack trace needs, so neither
+// happens on a checked thread. Call it once before the first check.
+void prepare();
+
+// Every pthread mutex lock counts by default, since a lock that happens to be free in a check may
+// have to wait on a busy system. Turning strict mode off counts only a lock that had to wait for
+// another thread.
+void setStrict(bool shouldCountEveryLock);
+
+// The calls counted so far, on all threads.
+int getNumViolations();
+
+// Checks the calling thread while it exists. The context names the check in reports.
+class ScopedCheck
+{
+public:
+    explicit ScopedCheck(const char* context);
+    ~ScopedCheck();
+
+    ScopedCheck(const ScopedCheck&) = delete;
+    ScopedCheck& operator=(const ScopedCheck&) = delete;
+
+private:
+    bool wasChecking;
+    const char* previousContext;
+};
+} // namespace RealtimeGuard
@@ -0,0 +1,308 @@
+#include <JuceHeader.h>
+
+#include "Common/HeadlessHost.h"
+#include "PluginProcessor.h"
+
+namespace
+{
+struct RenderOptions
+{
+    File stateFile;
+    File outputDirectory;
+    String suffix = "-amorphetude";
+    int blockSize = 512;
+    int bitDepth = 0;
+    double maximumTail = 10.0;
+    Array<File> inputFiles;
+};
+
+void printUsage()
+{
+    std::cout << "Usage: AmorphetudeRender [options] <input> [<input> ...]" << std::endl
+              << std::endl
+              << "Streams audio files through the Amorphetude effect chain without a host." << std::endl
+              << std::endl
+              << "  --state <file>       state blob saved by the plugin (getStateInformation)" << std::endl
+              << "  --output-dir <dir>   where rendered files are written (default: next to the input)" << std::endl
+              << "  --suffix <text>      appended to the rendered file names (default: -amorphetude)" << std::endl
+              << "  --block-size <n>     samples per processBlock call (default: 512)" << std::endl
+              << "  --bit-depth <n>      16, 24 or 32 (float) bits per sample (default: same as input)" << std::endl
+              << "  --max-tail <s>       longest effect tail rendered past the end of the input (default: 10)" << std::endl;
+}
+
+bool parseOptions(ArgumentList& args, RenderOptions& options)
+{
+    auto cwd = File::getCurrentWorkingDirectory();
+
+    if (args.containsOption("--state"))
+        options.stateFile = cwd.getChildFile(args.removeValueForOption("--state"));
+
+    if (args.containsOption("--output-dir"))
+        options.outputDirectory = cwd.getChildFile(args.removeValueForOption("--output-dir"));
+
+    if (args.containsOption("--suffix"))
+        options.suffix = args.removeValueForOption("--suffix");
+
+    if (args.containsOption("--block-size"))
+        options.blockSize = args.removeValueForOption("--block-size").getIntValue();
+
+    if (args.containsOption("--bit-depth"))
+        options.bitDepth = args.removeValueForOption("--bit-depth").getIntValue();
+
+    if (args.containsOption("--max-tail"))
+        options.maximumTail = args.removeValueForOption("--max-tail").getDoubleValue();
+
+    for (auto& argument : args.arguments)
+    {
+        if (argument.isOption())
+        {
+            std::cerr << "Unknown option: " << argument.text << std::endl;
+            return false;
+        }
+
+        options.inputFiles.add(cwd.getChildFile(argument.text));
+    }
+
+    if (options.blockSize <= 0)
+    {
+        std::cerr << "The block size must be positive" << std::endl;
+        return false;
+    }
+
+    if (options.maximumTail < 0.0)
+    {
+        std::cerr << "The maximum tail must not be negative" << std::endl;
+        return false;
+    }
+
+    if (options.bitDepth != 0 && options.bitDepth != 16 && options.bitDepth != 24 && options.bitDepth != 32)
+    {
+        std::cerr << "Unsupported bit depth: " << options.bitDepth << std::endl;
+        return false;
+    }
+
+    return ! options.inputFiles.isEmpty();
+}
+
+// WAV and AIFF inputs are memory mapped, everything else falls back to a regular stream reader.
+// Either way the reader is wrapped in a BufferingAudioReader so that disk reads run ahead of the
+// DSP on a background thread.
+std::unique_ptr<AudioFormatReader> createStreamingReader(AudioFormatManager& formatManager,
+                                                         const File& file,
+                                                         TimeSliceThread& readAheadThread,
+                                                         int samplesToBuffer)
+{
+    std::unique_ptr<AudioFormatReader> source;
+
+    if (auto* format = formatManager.findFormatForFileExtension(file.getFileExtension()))
+    {
+        std::unique_ptr<MemoryMappedAudioFormatReader> mappedReader(format->createMemoryMappedReader(file));
+
+        if (mappedReader != nullptr && mappedReader->mapEntireFile())
+            source = std::move(mappedReader);
+    }
+
+    if (source == nullptr)
+        source.reset(formatManager.createReaderFor(file));
+
+    if (source == nullptr)
+        return {};
+
+    auto bufferingReader = std::make_unique<BufferingAudioReader>(source.release(), readAheadThread, samplesToBuffer);
+    bufferingReader->setReadTimeout(-1);
+
+    return bufferingReader;
+}
+
+std::unique_ptr<AudioFormatWriter> createWriter(const File& file, double sampleRate, int numChannels, int bitDepth)
+{
+    file.deleteFile();
+
+    std::unique_ptr<OutputStream> stream(file.createOutputStream());
+
+    if (stream == nullptr)
+        return {};
+
+    WavAudioFormat wavFormat;
+    std::unique_ptr<AudioFormatWriter> writer(wavFormat.createWriterFor(stream.get(),
+                                                                        sampleRate,
+                                                                        (unsigned int) numChannels,
+                                                                        bitDepth,
+                                                                        {},
+                                                                        0));
+
+    if (writer != nullptr)
+        stream.release();
+
+    return writer;
+}
+
+bool renderFile(const File& inputFile, const RenderOptions& options, const MemoryBlock& state)
+{
+    AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    TimeSliceThread readAheadThread("Amorphetude Render Reader");
+    TimeSliceThread writerThread("Amorphetude Render Writer");
+    readAheadThread.startThread();
+    writerThread.startThread();
+
+    const auto bufferedSamples = options.blockSize * 64;
+
+    auto reader = createStreamingReader(formatManager, inputFile, readAheadThread, bufferedSamples);
+
+    if (reader == nullptr)
+    {
+        std::cerr << "Cannot read " << inputFile.getFullPathName() << std::endl;
+        return false;
+    }
+
+    const auto sampleRate = reader->sampleRate;
+    const auto numChannels = (int) reader->numChannels;
+    const auto lengthInSamples = reader->lengthInSamples;
+
+    auto bitDepth = options.bitDepth;
+
+    if (bitDepth == 0)
+        bitDepth = reader->usesFloatingPointData ? 32 : jlimit(16, 24, (int) reader->bitsPerSample);
+
+    std::unique_ptr<AmorphetudeAudioProcessor> processor;
+    bool isLayoutSupported = false;
+
+    HeadlessHost::callOnMessageThread([&] {
+        processor = std::make_unique<AmorphetudeAudioProcessor>();
+        isLayoutSupported = HeadlessHost::setChannelCount(*processor, numChannels);
+
+        if (isLayoutSupported && ! state.isEmpty())
+            processor->setStateInformation(state.getData(), (int) state.getSize());
+    });
+
+    if (! isLayoutSupported)
+    {
+        std::cerr << "Unsupported channel count " << numChannels << " in " << inputFile.getFullPathName() << std::endl;
+        HeadlessHost::callOnMessageThread([&] { processor.reset(); });
+        return false;
+    }
+
+    auto outputDirectory = options.outputDirectory == File() ? inputFile.getParentDirectory() : options.outputDirectory;
+    auto outputFile = outputDirectory.getChildFile(inputFile.getFileNameWithoutExtension() + options.suffix + ".wav");
+
+    auto writer = createWriter(outputFile, sampleRate, numChannels, bitDepth);
+
+    if (writer == nullptr)
+    {
+        std::cerr << "Cannot write " << outputFile.getFullPathName() << std::endl;
+        HeadlessHost::callOnMessageThread([&] { processor.reset(); });
+        return false;
+    }
+
+    AudioFormatWriter::ThreadedWriter threadedWriter(writer.release(), writerThread, bufferedSamples);
+
+    HeadlessHost::prepare(*processor, sampleRate, options.blockSize, true);
+
+    // run on past the end of the input by the chain's latency, and drop as much from the start,
+    // so the output lines up with the input; then let the effect tails ring out
+    const auto latency = (int64) processor->getLatencySamples();
+    const auto tail = (int64) std::ceil(jmin(processor->getTailLengthSeconds(), options.maximumTail) * sampleRate);
+    const auto totalSamples = lengthInSamples + latency + tail;
+
+    AudioBuffer<float> buffer(numChannels, options.blockSize);
+    std::vector<const float*> channels((size_t) numChannels);
+    MidiBuffer midi;
+
+    const auto startTime = Time::getMillisecondCounterHiRes();
+    int lastProgress = -1;
+
+    for (int64 position = 0; position < totalSamples; position += options.blockSize)
+    {
+        const auto numSamples = (int) jmin((int64) options.blockSize, totalSamples - position);
+
+        // the reader fills anything past the end of the input with silence
+        buffer.setSize(numChannels, numSamples, false, false, true);
+        reader->read(&buffer, 0, numSamples, position, true, true);
+
+        processor->processBlock(buffer, midi);
+
+        const auto numToSkip = (int) jlimit((int64) 0, (int64) numSamples, latency - position);
+
+        if (numToSkip < numSamples)
+        {
+            for (int channel = 0; channel < numChannels; ++channel)
+                channels[(size_t) channel] = buffer.getReadPointer(channel, numToSkip);
+
+            while (! threadedWriter.write(channels.data(), numSamples - numToSkip))
+                Thread::sleep(1);
+        }
+
+        const auto progress = (int) (100 * (position + numSamples) / totalSamples);
+
+        if (progress / 10 != lastProgress / 10)
+        {
+            std::cout << "  " << progress << "%" << std::endl;
+            lastProgress = progress;
+        }
+    }
+
+    const auto elapsedSeconds = (Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    const auto audioSeconds = (double) lengthInSamples / sampleRate;
+
+    HeadlessHost::callOnMessageThread([&] {
+        processor->releaseResources();
+        processor.reset();
+    });
+
+    std::cout << "  -> " << outputFile.getFullPathName() << " (" << String(audioSeconds, 1) << " s of audio in "
+              << String(elapsedSeconds, 2) << " s, " << String(audioSeconds / jmax(elapsedSeconds, 1.0e-9), 1)
+              << "x realtime)" << std::endl;
+
+    return true;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    ArgumentList args(argc, argv);
+    RenderOptions options;
+
+    if (args.containsOption("--help|-h") || ! parseOptions(args, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    MemoryBlock state;
+
+    if (options.stateFile != File() && ! options.stateFile.loadFileAsData(state))
+    {
+        std::cerr << "Cannot read state file " << options.stateFile.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    if (options.outputDirectory != File() && ! options.outputDirectory.createDirectory())
+    {
+        std::cerr << "Cannot create " << options.outputDirectory.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    return HeadlessHost::run([&] {
+        int numFailures = 0;
+
+        for (auto& inputFile : options.inputFiles)
+        {
+            std::cout << inputFile.getFullPathName() << std::endl;
+
+            if (! renderFile(inputFile, options, state))
+                ++numFailures;
+        }
+
+#if AMORPHETUDE_VERIFY_QUANTIZER
+        if (auto numMismatches = NoiseShapedQuantizer::getNumMismatches())
+        {
+            std::cerr << "The quantizer differed from its reference loop in " << (int64) numMismatches << " blocks" << std::endl;
+            ++numFailures;
+        }
+#endif
+
+        return numFailures == 0 ? 0 : 1;
+    });
+}